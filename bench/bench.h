@@ -0,0 +1,184 @@
+//
+// This file is part of ofxActiveScan.
+//
+// helpers shared by the benchmark programs: a wall clock, the best of a
+// few runs, and random frames that exercise every branch of the kernels.
+//
+
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#if defined(__linux__)
+#include <cstring>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "Field.h"
+#include "Simd.h"
+
+namespace bench
+{
+
+// seconds on a monotonic clock
+inline double Now(void)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// fastest of 'runs' calls of 'func', in milliseconds
+template <typename function_t>
+double BestOf(const int runs, function_t func)
+{
+	double best = 1e30;
+	for (int i = 0; i < runs; i++) {
+		double t0 = Now();
+		func();
+		best = std::min(best, Now() - t0);
+	}
+	return best * 1e3;
+}
+
+inline unsigned int Hash(unsigned int x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+// kernels the build selected in Simd.h
+inline const char *SimdName(void)
+{
+#if defined(SLIB_SIMD_AVX2)
+	return "AVX2";
+#elif defined(SLIB_SIMD_SSE2)
+	return "SSE2";
+#else
+	return "scalar";
+#endif
+}
+
+// last-level and L1 data cache misses of the calling thread, read from
+// the hardware counters with perf_event_open(2). virtual machines and
+// other systems without the counters leave it unavailable.
+class CacheCounter
+{
+public:
+	enum { LLC, L1D, NCOUNTERS };
+
+	CacheCounter()
+	{
+		for (int i = 0; i < NCOUNTERS; i++)
+			m_fd[i] = -1;
+#if defined(__linux__)
+		m_fd[LLC] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+		m_fd[L1D] = open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+			(PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+#endif
+	}
+
+	~CacheCounter()
+	{
+#if defined(__linux__)
+		for (int i = 0; i < NCOUNTERS; i++)
+			if (m_fd[i] >= 0)
+				close(m_fd[i]);
+#endif
+	}
+
+	bool IsAvailable(void) const { return m_fd[LLC] >= 0 && m_fd[L1D] >= 0; }
+
+	// misses during func(), -1 without the counters
+	template <typename function_t>
+	void Count(function_t func, long long misses[NCOUNTERS])
+	{
+		for (int i = 0; i < NCOUNTERS; i++)
+			misses[i] = -1;
+#if defined(__linux__)
+		if (!IsAvailable()) {
+			func();
+			return;
+		}
+		for (int i = 0; i < NCOUNTERS; i++) {
+			ioctl(m_fd[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(m_fd[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+		func();
+		for (int i = 0; i < NCOUNTERS; i++) {
+			ioctl(m_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+			if (read(m_fd[i], &misses[i], sizeof(misses[i])) != (ssize_t)sizeof(misses[i]))
+				misses[i] = -1;
+		}
+#else
+		func();
+#endif
+	}
+
+private:
+#if defined(__linux__)
+	static int open(unsigned int type, unsigned long long config)
+	{
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+#endif
+
+	int m_fd[NCOUNTERS];
+};
+
+// size of the last-level cache in bytes, 0 if unknown
+inline long GetLastLevelCacheSize(void)
+{
+#if defined(__linux__) && defined(_SC_LEVEL3_CACHE_SIZE)
+	long size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+	if (size <= 0)
+		size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	return std::max(size, 0L);
+#else
+	return 0;
+#endif
+}
+
+// 'nframes' images of uniform noise in [lo, hi)
+inline void RandomFrames(const int width, const int height, const int nframes, const float lo, const float hi, std::vector<slib::Field<2,float> >& frames)
+{
+	frames.resize(nframes);
+	for (int t = 0; t < nframes; t++) {
+		frames[t].Initialize(width, height);
+		for (int i = 0; i < width * height; i++)
+			frames[t].ptr()[i] = lo + (hi - lo) * (Hash(i * 31 + t * 7919) % 65536) / 65536.0f;
+	}
+}
+
+// image size from the command line, 'width' x 'height' by default
+inline void ParseSize(int argc, char **argv, int& width, int& height)
+{
+	if (argc > 2) {
+		width = atoi(argv[1]);
+		height = atoi(argv[2]);
+	}
+	if (width <= 0 || height <= 0) {
+		fprintf(stderr, "usage: %s [width height]\n", argv[0]);
+		exit(1);
+	}
+}
+
+} // namespace bench
@@ -0,0 +1,97 @@
+//
+// This file is part of ofxActiveScan.
+//
+// gray-code decoding: the original loop, which adds every level to a
+// code word image and converts pixel by pixel, against the row kernels
+// PackGrayCodeBits() and ConvertGrayToBinary() behind DecodeGrayCodeImages().
+//
+//   bench_graycode [width height]
+//
+
+#include "bench.h"
+#include "ImageBmpIO.h"
+#include "GrayCode.h"
+
+using namespace slib;
+
+namespace original
+{
+
+inline
+int ConvertGrayToBinary(const unsigned long graycode)
+{
+	int bincode = 0;
+	int mask = 1;
+	while ((unsigned long)mask < graycode)
+		mask *= 2;
+	for (; mask; mask /= 2)
+		bincode += (mask & graycode) ^ (mask & (bincode / 2));
+	return bincode;
+}
+
+inline 
+void DecodeGrayCodeImages(const std::vector<Field<2,float> >& bmps, Field<2,float>& result)
+{
+	int nlevels = bmps.size();
+	const CVector<2,int>& size = bmps[0].size();
+
+	// load binary codes
+	Field<2, unsigned long> binary(size, 0);
+	for (int l=0; l<nlevels; l++)
+		for (int y = 0; y < size[1]; y++)
+			for (int x = 0; x < size[0]; x++)
+				if (bmps[l].cell(x, y) > 0)
+					binary.cell(x, y) += (1 << l);
+
+	// decode
+	result.Initialize(size);
+	for (int y = 0; y < size[1]; y++)
+		for (int x = 0; x < size[0]; x++)
+			result.cell(x, y) = ConvertGrayToBinary(binary.cell(x, y));
+}
+
+} // namespace original
+
+int main(int argc, char **argv)
+{
+	int width = 3840, height = 2160;
+	bench::ParseSize(argc, argv, width, height);
+	const int nlevels = 12, runs = 3;
+
+	// signed differences of complementary pairs, as DecodeGrayCodeImages() takes them
+	std::vector<Field<2,float> > levels;
+	bench::RandomFrames(width, height, nlevels, -1, 1, levels);
+
+	Field<2,float> expected, result;
+	double t_original = bench::BestOf(1, [&]() { original::DecodeGrayCodeImages(levels, expected); });
+	double t_kernels = bench::BestOf(runs, [&]() { DecodeGrayCodeImages(levels, result); });
+
+	// the two kernels alone, on one row buffer
+	std::vector<unsigned int> code(width);
+	std::vector<float> zero(width, 0.0f);
+	double t_pack = bench::BestOf(runs, [&]() {
+		for (int y = 0; y < height; y++) {
+			std::fill(code.begin(), code.end(), 0);
+			for (int l = 0; l < nlevels; l++)
+				PackGrayCodeBits(levels[l].ptr() + y * width, &zero[0], l, &code[0], width);
+		}
+	});
+	double t_convert = bench::BestOf(runs, [&]() {
+		for (int y = 0; y < height; y++)
+			ConvertGrayToBinary(&code[0], result.ptr() + y * width, width);
+	});
+	DecodeGrayCodeImages(levels, result);
+
+	int mismatches = 0;
+	for (int i = 0; i < width * height; i++)
+		if (expected.ptr(i) != result.ptr(i))
+			mismatches++;
+
+	printf("%dx%d, %d levels, %s kernels\n", width, height, nlevels, bench::SimdName());
+	printf("  original loop          %8.1f ms\n", t_original);
+	printf("  DecodeGrayCodeImages   %8.1f ms  (%.1fx)\n", t_kernels, t_original / t_kernels);
+	printf("    PackGrayCodeBits     %8.1f ms\n", t_pack);
+	printf("    ConvertGrayToBinary  %8.1f ms\n", t_convert);
+	printf("  mismatching pixels     %8d\n", mismatches);
+	return mismatches ? 1 : 0;
+}
@@ -0,0 +1,100 @@
+//
+// This file is part of ofxActiveScan.
+//
+// scaling of the capture pipeline with the number of decoding threads: a
+// simulated scan is fed through RunCapture() into a CAsyncDecode whose
+// stages run on pools of 1 to N threads, as fast as it is taken.
+//
+//   bench_scaling [width height [threads]]
+//
+// 'threads' is N, the hardware threads by default.
+//
+
+#include <thread>
+
+#include "scene.h"
+#include "CaptureSource.h"
+
+using namespace slib;
+
+// 8-bit gray frames rendered in memory, so that neither a camera nor
+// the disk enters the measurement
+class CFrameSource : public CCaptureSource
+{
+public:
+	CFrameSource(const std::vector<std::vector<unsigned char> >& frames, const int width, const int height)
+		: m_frames(frames), m_width(width), m_height(height), m_next(0) {}
+
+	void Rewind(void) { m_next = 0; }
+
+	int GetNumFrames(void) const { return (int)m_frames.size(); }
+
+	bool Grab(CFrameView& frame)
+	{
+		if (m_next >= m_frames.size())
+			return false;
+		frame = CFrameView(&m_frames[m_next++][0], m_width, m_height);
+		return true;
+	}
+
+private:
+	const std::vector<std::vector<unsigned char> >& m_frames;
+	int m_width, m_height;
+	size_t m_next;
+};
+
+int main(int argc, char **argv)
+{
+	int width = 1920, height = 1080;
+	bench::ParseSize(argc, argv, width, height);
+	int maxthreads = argc > 3 ? atoi(argv[3]) : (int)std::thread::hardware_concurrency();
+	maxthreads = std::max(1, maxthreads);
+	const int runs = 3;
+
+	options_t options;
+	CProCamSimulate sim(options);
+	bench::SetupScene(sim, options, width, height);
+	CEncode encoder(options);
+	std::vector<std::vector<unsigned char> > frames(encoder.GetNumImages(), std::vector<unsigned char>((size_t)width * height));
+	for (int t = 0; t < encoder.GetNumImages(); t++)
+		sim.Render(encoder, t, &frames[t][0]);
+	CFrameSource source(frames, width, height);
+
+	printf("%dx%d, %d frames, %s kernels, %u hardware threads\n", width, height, (int)frames.size(), bench::SimdName(), std::thread::hardware_concurrency());
+	printf("  threads     fps  speedup  decode ms/frame  finish ms  mask mismatches\n");
+
+	Field<2,float> reference;
+	double base = 0;
+	for (int nthreads = 1; ; nthreads = std::min(2 * nthreads, maxthreads)) {
+		CThreadPool pool(nthreads);
+		capture_stats_t best;
+		Field<2,float> mask;
+		for (int r = 0; r < runs; r++) {
+			CAsyncDecode decoder(options);
+			decoder.SetThreadPool(pool);
+			source.Rewind();
+			capture_stats_t stats = RunCapture(source, decoder);
+			if (!stats.finished) {
+				fprintf(stderr, "the scan was not decoded with %d threads\n", nthreads);
+				return 1;
+			}
+			if (r == 0 || stats.fps > best.fps)
+				best = stats;
+			mask = decoder.GetDecoder().GetMask();
+		}
+		if (nthreads == 1) {
+			reference = mask;
+			base = best.fps;
+		}
+		int mismatches = 0;
+		for (int i = 0; i < width * height; i++)
+			if (mask.ptr(i) != reference.ptr(i))
+				mismatches++;
+
+		printf("  %7d %7.1f %7.2fx %16.2f %10.1f %16d\n", nthreads, best.fps, best.fps / base,
+			best.decode.mean() * 1e3, best.finish * 1e3, mismatches);
+		if (nthreads == maxthreads)
+			break;
+	}
+	return 0;
+}
@@ -0,0 +1,170 @@
+//
+// This file is part of ofxActiveScan.
+//
+// a captured sequence kept as one float image per frame against the
+// pixel-major CFrameStack: first the per-pixel kernels of one direction on
+// the same frames, with their cache misses, then the whole decoder,
+// CDecode::AddImage() frame by frame against filling a stack and
+// CDecode::Decode() of it.
+//
+//   bench_stack [width height]
+//
+// cache misses are read from the hardware counters where perf_event_open(2)
+// provides them. without them, the memory traffic of each layout is
+// modeled instead: once a frame is larger than the last-level cache, every
+// pass over an image streams it from memory, so the bytes the passes read
+// and write stand for the cache lines they miss.
+//
+
+#include "scene.h"
+#include "decode.h"
+
+using namespace slib;
+
+// bytes the per-frame passes of the kernel benchmark stream for each pixel
+static size_t frames_traffic(const int nbits, const int nphases)
+{
+	const size_t f = sizeof(float);
+	return f * (
+		2 * 2 +			// clearing code words and uncertainty, then the sums
+		nbits * (2 +	// GetImageMax() of both images of the pair
+			2 +			// AccumulateGrayCodePair() reads the pair,
+			2 * 2) +	// and reads and writes code words and uncertainty
+		2 +				// DecodeGrayCode() reads code words, writes the map
+		nphases * (1 +	// AccumulatePhaseCodeImage() reads the image,
+			2 * 2) +	// and reads and writes both sums
+		2 * 2);			// DecodePhaseCodeSums() reads the sums, writes phase and amplitude
+}
+
+// bytes the stack kernels stream for each pixel: every 16-bit sample once,
+// and the four maps they write
+static size_t stack_traffic(const int nbits, const int nphases)
+{
+	return sizeof(unsigned short) * (2 * nbits + nphases) + sizeof(float) * 4;
+}
+
+static void print_misses(const long long misses[bench::CacheCounter::NCOUNTERS], const double pixels)
+{
+	if (misses[bench::CacheCounter::LLC] < 0)
+		printf("  n/a");
+	else
+		printf("  LLC %6.2f  L1D %6.2f misses/pixel",
+			misses[bench::CacheCounter::LLC] / pixels, misses[bench::CacheCounter::L1D] / pixels);
+}
+
+int main(int argc, char **argv)
+{
+	int width = 1920, height = 1080;
+	bench::ParseSize(argc, argv, width, height);
+	const int runs = 3;
+	const double pixels = (double)width * height;
+
+	// kernels: 10 complementary gray-code pairs and 8 phases, random
+	// intensities so that every branch is taken, on one thread so that
+	// the counters see all of the work
+	{
+		const int nbits = 10, nphases = 8, nframes = 2 * nbits + nphases;
+		const float threshold = 0.1f;
+		std::vector<Field<2,float> > frames;
+		bench::RandomFrames(width, height, nframes, 0, 1, frames);
+		CFrameStack stack(frames[0].size(), nframes);
+		double t_fill = bench::BestOf(runs, [&]() {
+			for (int t = 0; t < nframes; t++)
+				stack.SetFrame(t, frames[t]);
+		});
+
+		Field<2,unsigned int> code(width, height);
+		Field<2,int> uncertainty(width, height);
+		Field<2,float> gray(width, height), sum_cos(width, height), sum_sin(width, height);
+		Field<2,float> phase(width, height), amplitude(width, height);
+		auto decode_frames = [&]() {
+			code.Clear(0);
+			uncertainty.Clear(0);
+			for (int b = 0; b < nbits; b++) {
+				const Field<2,float>& a = frames[2 * b], &c = frames[2 * b + 1];
+				float th = threshold * std::max(GetImageMax(a, 0, height), GetImageMax(c, 0, height));
+				AccumulateGrayCodePair(a, c, nbits - 1 - b, th, code, uncertainty, 0, height);
+			}
+			DecodeGrayCode(code, gray, 0, height);
+			sum_cos.Clear(0);
+			sum_sin.Clear(0);
+			for (int k = 0; k < nphases; k++)
+				AccumulatePhaseCodeImage(frames[2 * nbits + k], k, nphases, sum_cos, sum_sin, 0, height);
+			DecodePhaseCodeSums(sum_cos, sum_sin, nphases, phase, amplitude, 0, height);
+		};
+		auto decode_stack = [&]() {
+			DecodeGrayCodeStack(stack, 0, nbits, threshold, gray, uncertainty, 0, height);
+			DecodePhaseCodeStack(stack, 2 * nbits, nphases, phase, amplitude, 0, height);
+		};
+		double t_frames = bench::BestOf(runs, decode_frames);
+		double t_stack = bench::BestOf(runs, decode_stack);
+
+		bench::CacheCounter counter;
+		long long frames_misses[bench::CacheCounter::NCOUNTERS], stack_misses[bench::CacheCounter::NCOUNTERS];
+		counter.Count(decode_frames, frames_misses);
+		counter.Count(decode_stack, stack_misses);
+
+		const long llc = bench::GetLastLevelCacheSize();
+		printf("%dx%d, %d frames of one direction, %s kernels, one thread\n", width, height, nframes, bench::SimdName());
+		printf("  %-22s %8s  %9s  %s\n", "", "time", "traffic", "cache misses");
+		printf("  %-22s %5.1f ms  %6.0f MB", "float frames", t_frames, frames_traffic(nbits, nphases) * pixels / 1e6);
+		print_misses(frames_misses, pixels);
+		printf("\n  %-22s %5.1f ms  %6.0f MB", "CFrameStack", t_stack, stack_traffic(nbits, nphases) * pixels / 1e6);
+		print_misses(stack_misses, pixels);
+		printf("\n  %-22s %5.1f ms\n", "filling the stack", t_fill);
+		printf("  %-22s %5.1f ms  (%.2fx the float frames)\n", "fill + stack", t_fill + t_stack, (t_fill + t_stack) / t_frames);
+		if (!counter.IsAvailable())
+			printf("  no hardware cache counters here\n");
+		if (llc > 0 && sizeof(float) * pixels <= llc)
+			printf("  frames of %.1f MB fit in the %.0f MB last-level cache, so the modeled traffic\n"
+				"  overstates the misses of the float frames\n", sizeof(float) * pixels / 1e6, llc / 1e6);
+	}
+
+	// the decoder on a simulated scan of both directions. the stream
+	// decodes each frame as it arrives, while the stack has to be filled
+	// with every frame before it can be decoded, so the fill belongs to
+	// its cost.
+	{
+		options_t options;
+		CProCamSimulate sim(options);
+		bench::SetupScene(sim, options, width, height);
+		CEncode encoder(options);
+		const int nframes = encoder.GetNumImages();
+		std::vector<Field<2,float> > frames(nframes);
+		for (int t = 0; t < nframes; t++)
+			sim.Render(encoder.GetImage(t), frames[t], t);
+
+		Field<2,float> mask;
+		double t_frames = bench::BestOf(runs, [&]() {
+			CDecode decoder(options);
+			for (int t = 0; t < nframes; t++)
+				decoder.AddImage(frames[t]);
+			mask = decoder.GetMask();
+		});
+
+		CFrameStack stack(frames[0].size(), nframes);
+		double t_fill = bench::BestOf(runs, [&]() {
+			for (int t = 0; t < nframes; t++)
+				stack.SetFrame(t, frames[t]);
+		});
+		Field<2,float> stack_mask;
+		double t_stack = bench::BestOf(runs, [&]() {
+			CDecode decoder(options);
+			decoder.Decode(stack);
+			stack_mask = decoder.GetMask();
+		});
+
+		int mismatches = 0;
+		for (int i = 0; i < width * height; i++)
+			if (mask.ptr(i) != stack_mask.ptr(i))
+				mismatches++;
+
+		printf("%dx%d, %d frames of both directions, pool of %d threads\n", width, height, nframes, CThreadPool::GetShared().GetNumThreads());
+		printf("  %-22s %8.1f ms\n", "CDecode::AddImage", t_frames);
+		printf("  %-22s %8.1f ms\n", "filling the stack", t_fill);
+		printf("  %-22s %8.1f ms\n", "CDecode::Decode(stack)", t_stack);
+		printf("  %-22s %8.1f ms  (%.2fx AddImage)\n", "fill + Decode(stack)", t_fill + t_stack, (t_fill + t_stack) / t_frames);
+		printf("  %-22s %8d\n", "mask mismatches", mismatches);
+	}
+	return 0;
+}
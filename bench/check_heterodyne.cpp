@@ -0,0 +1,100 @@
+//
+// This file is part of ofxActiveScan.
+//
+// reliability of the heterodyne unwrapping on a simulated scan: the
+// pixels CDecode marks reliable are compared with the projector pixels
+// the simulation lit them with, and any that is off by more than a pixel
+// fails the check. the frames are decoded both as they arrive and from a
+// stack, for three and four shifts and a focused and a blurred projector.
+//
+//   check_heterodyne [width height]
+//
+// the projector is 512x384 pixels. exits with 1 on failure.
+//
+
+#include "scene.h"
+#include "decode.h"
+
+using namespace slib;
+
+struct result_t {
+	result_t() : reliable(0), wrong(0), error(0) {}
+	int reliable;	// reliable pixels the projector lights
+	int wrong;		// of them, off by more than a pixel
+	double error;	// sum of the errors of the others
+};
+
+static result_t compare(const CDecode& decoder, const Field<2,float>& horizontal, const Field<2,float>& vertical, const Field<2,float>& lit)
+{
+	result_t r;
+	const int n = lit.size(0) * lit.size(1);
+	for (int i = 0; i < n; i++) {
+		if (!(decoder.GetReliable().ptr(i) > 0 && decoder.GetMask().ptr(i) > 0) || !(lit.ptr(i) > 0))
+			continue;
+		r.reliable++;
+		float e = std::max(std::abs(decoder.GetHorizontal().ptr(i) - horizontal.ptr(i)),
+			std::abs(decoder.GetVertical().ptr(i) - vertical.ptr(i)));
+		if (!(e <= 1))
+			r.wrong++;
+		else
+			r.error += e;
+	}
+	return r;
+}
+
+int main(int argc, char **argv)
+{
+	int width = 640, height = 480;
+	bench::ParseSize(argc, argv, width, height);
+
+	const int shifts[] = { 3, 4 };
+	const float defocus[] = { 0, 1 };
+	int failures = 0;
+	printf("%dx%d camera, 512x384 projector\n", width, height);
+	printf("  %-22s %9s %8s  %s\n", "", "reliable", "off >1px", "mean error");
+	for (int s = 0; s < 2; s++)
+		for (int j = 0; j < 2; j++) {
+			options_t options;
+			options.projector_width = 512;
+			options.projector_height = 384;
+			options.pattern = options_t::PATTERN_HETERODYNE;
+			options.heterodyne_shifts = shifts[s];
+
+			CProCamSimulate sim(options);
+			bench::SetupScene(sim, options, width, height);
+			CProCamSimulate::params_t params;
+			params.defocus = defocus[j];
+			sim.SetParams(params);
+			Field<2,float> horizontal, vertical, lit;
+			sim.GetCorrespondence(horizontal, vertical, lit);
+
+			CEncode encoder(options);
+			const int nframes = encoder.GetNumImages();
+			std::vector<std::vector<unsigned char> > frames(nframes, std::vector<unsigned char>(width * height));
+			for (int t = 0; t < nframes; t++)
+				sim.Render(encoder, t, &frames[t][0]);
+
+			CDecode stream(options);
+			for (int t = 0; t < nframes; t++)
+				stream.AddImage(&frames[t][0], width, height);
+			CFrameStack stack(make_vector(width, height), nframes);
+			for (int t = 0; t < nframes; t++)
+				stack.SetFrame(t, CFrameView(&frames[t][0], width, height));
+			CDecode stacked(options);
+			stacked.Decode(stack);
+
+			const CDecode *decoders[] = { &stream, &stacked };
+			const char *names[] = { "stream", "stack" };
+			for (int d = 0; d < 2; d++) {
+				result_t r = compare(*decoders[d], horizontal, vertical, lit);
+				char label[64];
+				snprintf(label, sizeof(label), "%d shifts, defocus %.0f, %s", shifts[s], defocus[j], names[d]);
+				printf("  %-22s %9d %8d  %.3f px\n", label, r.reliable, r.wrong,
+					r.reliable > r.wrong ? r.error / (r.reliable - r.wrong) : 0);
+				if (r.wrong)
+					failures++;
+			}
+		}
+	printf(failures ? "FAILED\n" : "passed\n");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,62 @@
+//
+// This file is part of ofxActiveScan.
+//
+// the scene of the benchmarks: a wall 3 m from the camera and a ball of
+// 0.4 m radius 2 m away, lit by a projector 0.3 m to the right of the
+// camera, turned toward them. the camera sees the projector image at about
+// its own resolution whatever its size.
+//
+
+#pragma once
+
+#include "bench.h"
+#include "simulate.h"
+
+namespace bench
+{
+
+inline void SetupScene(CProCamSimulate& sim, const options_t& options, const int width, const int height)
+{
+	using namespace slib;
+
+	const double f = 1.1 * width;
+	CMatrix<3,3,double> cam = make_matrix<double>(
+		f, 0, (width - 1) * 0.5,
+		0, f, (height - 1) * 0.5,
+		0, 0, 1);
+	const int pw = options.projector_width, ph = options.projector_height;
+	const double fp = 1.6 * pw;
+	CMatrix<3,3,double> pro = make_matrix<double>(
+		fp, 0, (pw - 1) * 0.5,
+		0, fp, (ph - 1) * 0.5,
+		0, 0, 1);
+
+	// rotation about y, then the projector center moved to 'center'
+	const double a = 6 * M_PI / 180;
+	const CVector<3,double> center = make_vector<double>(0.3, 0.05, 0);
+	CMatrix<3,4,double> rt;
+	rt(0,0) = cos(a);  rt(0,2) = sin(a);
+	rt(1,1) = 1;
+	rt(2,0) = -sin(a); rt(2,2) = cos(a);
+	for (int r = 0; r < 3; r++)
+		rt(r,3) = -(rt(r,0) * center[0] + rt(r,1) * center[1] + rt(r,2) * center[2]);
+
+	sim.SetCamera(width, height, cam);
+	sim.SetProjector(pro, 0, rt);
+
+	Field<2,float> depth(width, height);
+	for (int y = 0; y < height; y++)
+		for (int x = 0; x < width; x++) {
+			// first hit of the ray t*(u,v,1) with the ball
+			double u = (x - (width - 1) * 0.5) / f, v = (y - (height - 1) * 0.5) / f;
+			double A = u * u + v * v + 1, B = -4, C = 4 - 0.16;
+			double D = B * B - 4 * A * C;
+			double z = 3;
+			if (D >= 0)
+				z = std::min(z, (-B - sqrt(D)) / (2 * A));
+			depth.cell(x, y) = (float)z;
+		}
+	sim.SetDepth(depth);
+}
+
+} // namespace bench
@@ -42,68 +42,95 @@ void testApp::init() {
 	fs["grayLow"] >> grayLow;
 	fs["grayHigh"] >> grayHigh;
 	fs["devID"] >> devID;
-	fs["bufferTime"] >> bufferTime;
 	fs["vertical_center"] >> options.projector_horizontal_center;
 	fs["nsamples"] >> options.nsamples;
+	fs["minDecodable"] >> options.min_decodable;
 	
 	camera.listDevices();
 	camera.setDeviceID(devID);
 	camera.initGrabber(cw, ch);
 	
-	captureTime = 0;
 	started = false;
+	decoding = false;
 	
 	encoder = new Encoder(options);
-	decoder = new Decoder(options);
 	
-	imageUpdateTrigger = false;
+	// the patterns are written to a file once and mapped back, so that
+	// drawing only uploads them. the file is written again when the
+	// options that shape the patterns change.
+	string sequencePath = ofToDataPath(rootDir[0] + "/patterns.seq", true);
+	try {
+		sequence.Open(sequencePath, options);
+	} catch( std::exception& e ) {
+		ofLogNotice() << "writing " << sequencePath << " (" << e.what() << ")";
+		PatternSequence::Write(*encoder, sequencePath, PatternSequence::FORMAT_RAW);
+		sequence.Open(sequencePath, options);
+	}
+	
+	decoder = new AsyncDecoder(options, 4, cw, ch, 3);
+	scheduler.setup(encoder->GetNumImages());
+	curPatternId = -1;
 }
 
 void testApp::update() {
 	if( pathLoaded ) {
 		
-		unsigned long curTime = ofGetSystemTime();
-		bool needToCapture = started && ((curTime - captureTime) > bufferTime);
+		if( decoding && decoder->IsFinished() ) {
+			Map2f horizontal, vertical;
+			ofImage mask, reliable;
+			
+			horizontal = decoder->GetDecoder().GetHorizontal();
+			vertical = decoder->GetDecoder().GetVertical();
+			mask = toOf(decoder->GetDecoder().GetMask());
+			reliable = toOf(decoder->GetDecoder().GetReliable());
+			
+			horizontal.Write(ofToDataPath(rootDir[0] + "/h.map", true));
+			vertical.Write(ofToDataPath(rootDir[0] + "/v.map", true));
+			mask.saveImage(ofToDataPath(rootDir[0] + "/mask.png"));
+			reliable.saveImage(ofToDataPath(rootDir[0] + "/reliable.png"));
+			
+			decoding = false;
+		}
+		
+		if( started && decoder->IsRejected() ) {
+			// too dark or misaimed; start over once the setup is fixed
+			float contrast, decodable;
+			decoder->GetDecoder().GetQuality(contrast, decodable);
+			ofLogWarning() << "scan rejected: contrast " << contrast << ", decodable " << decodable;
+			// the pattern sequence is kept for the next scan
+			delete decoder;
+			decoder = new AsyncDecoder(options, 4, cw, ch, 3);
+			scheduler.setup(encoder->GetNumImages());
+			curPattern.clear();
+			curPatternId = -1;
+			started = false;
+		}
 		
 		camera.update();
-		curFrame.setFromPixels(camera.getPixels(), cw, ch, OF_IMAGE_COLOR);
-		curFrame.update();
 		
-		if( camera.isFrameNew() && needToCapture ) {
+		if( camera.isFrameNew() && !started ) {
+			// preview; the scan reads the camera pixels in place
+			curFrame.setFromPixels(camera.getPixels(), cw, ch, OF_IMAGE_COLOR);
+			curFrame.update();
+		} else if( camera.isFrameNew() ) {
+			FrameView frame = toAs(camera.getPixelsRef());
+			scheduler.update(frame, ofGetElapsedTimeMillis());
 			
-			if( !curPattern.isAllocated() ) { // first image
-				curFrame.saveImage(rootDir[0] + "/camPerspective.jpg");
-				prevFrame = curFrame;
-			} else {
-				// see if 20% of image changed
-				if( difference(camera.getPixelsRef(), prevFrame.getPixelsRef()) < 20 / 3 ) {
-					return;
-				}
-				
-				decoder->AddImage(toAs(curFrame));
-				prevFrame = curFrame;
-				imageUpdateTrigger = false;
+			// the frame showing a pattern arrives a few frames after it is
+			// drawn; the scheduler tells which one it is
+			if( scheduler.getCapture() >= 0 && !decoder->AddImage(frame) ) {
+				scheduler.retry(); // decoder queue is full, show the pattern again
 			}
 			
-			if( !encoder->IsFinished() ) {
-				curPattern = toOf(encoder->GetImage());
-				encoder->Proceed();
-			} else {
-				while ( decoder->IsFinished() ); // wait while decoding
-				
-				Map2f horizontal, vertical;
-				ofImage mask, reliable;
-				
-				horizontal = decoder->GetHorizontal();
-				vertical = decoder->GetVertical();
-				mask = toOf(decoder->GetMask());
-				reliable = toOf(decoder->GetReliable());
-				
-				horizontal.Write(ofToDataPath(rootDir[0] + "/h.map", true));
-				vertical.Write(ofToDataPath(rootDir[0] + "/v.map", true));
-				mask.saveImage(ofToDataPath(rootDir[0] + "/mask.png"));
-				reliable.saveImage(ofToDataPath(rootDir[0] + "/reliable.png"));
-				
+			if( scheduler.isFinished() ) {
+				ofLogVerbose() << "scanned with latency " << scheduler.getLatency() << " frames, "
+					<< scheduler.getRestarts() << " restarts, "
+					<< decoder->GetDropped() << " frames refused by the decoder queue";
+				// the maps are saved once the worker has decoded them
+				decoding = true;
+				started = false;
+			} else if( scheduler.isFailed() ) {
+				ofLogWarning() << "flash not seen: is the camera aimed at the projection?";
 				started = false;
 			}
 		}
@@ -118,12 +145,15 @@ void testApp::draw() {
 		
 		if( started ) {
 			ofSetColor(grayHigh);
-			if( curPattern.isAllocated() ) {
-				curPattern.draw(0, 0);
-				if( imageUpdateTrigger == false ) {
-					imageUpdateTrigger = true;
-					captureTime = ofGetSystemTime();
+			int display = scheduler.getDisplay();
+			if( display == CaptureScheduler::DISPLAY_WHITE ) {
+				ofRect(0, 0, ofGetWidth(), ofGetHeight());
+			} else if( display >= 0 ) {
+				if( display != curPatternId ) {
+					loadTexture(sequence, display, curPattern);
+					curPatternId = display;
 				}
+				curPattern.draw(0, 0);
 			}
 		} else if( ofGetWindowMode() != OF_FULLSCREEN ) {
 			curFrame.draw(0, 0);
@@ -137,7 +167,10 @@ void testApp::keyPressed(int key) {
 		
 		if(key == ' ') {
 			started = true;
-			prevFrame.setFromPixels(camera.getPixels(), cw, ch, OF_IMAGE_COLOR);
+			curFrame.saveImage(rootDir[0] + "/camPerspective.jpg");
+			
+			// the first scan flashes the projector to measure its latency
+			scheduler.start();
 		}
 		if( key == 'f' ) {
 			ofToggleFullscreen();
@@ -155,18 +188,3 @@ void testApp::dragEvent(ofDragInfo dragInfo){
 		pathLoaded = true;
 	}
 }
-
-int testApp::difference(ofPixels &p0, ofPixels &p1){
-	// subtract two images
-	ofPixels pout = p0;
-	int numChanged = 0;
-	int threshold = 3;
-	for (int i = 0; i < pout.size(); i++) {
-		pout[i] = ofMap(p0[i] - p1[i], -255, 255, 0, 255, true);
-		if (pout[i] < 128 - threshold || 128 + threshold < pout[i]) {
-			numChanged++;
-		}
-	}
-	
-	return numChanged * 100 / pout.size();
-}
@@ -42,7 +42,6 @@ void ofApp::init() {
 	fs["grayLow"] >> grayLow;
 	fs["grayHigh"] >> grayHigh;
 	fs["devID"] >> devID;
-	fs["bufferTime"] >> bufferTime;
 	fs["vertical_center"] >> options.projector_horizontal_center;
 	fs["nsamples"] >> options.nsamples;
 	
@@ -57,64 +56,62 @@ void ofApp::init() {
 	camera.listDevices();
 	camera.open(devID);
 	
-	captureTime = 0;
 	started = false;
+	decoding = false;
 	
+	// generate every pattern once, so that drawing only converts them
 	encoder = new Encoder(options);
-	decoder = new Decoder(options);
-	
-	imageUpdateTrigger = false;
+	encoder->Prepare();
+	decoder = new AsyncDecoder(options, 4, cw, ch, 3);
+	scheduler.setup(encoder->GetNumImages());
+	curPatternId = -1;
 }
 
 void ofApp::update() {
 	if( pathLoaded ) {
 		
-		unsigned long curTime = ofGetSystemTime();
-		bool needToCapture = started && ((curTime - captureTime) > bufferTime);
+		if( decoding && decoder->IsFinished() ) {
+			Map2f horizontal, vertical;
+			ofImage mask, reliable;
+			
+			horizontal = decoder->GetDecoder().GetHorizontal();
+			vertical = decoder->GetDecoder().GetVertical();
+			mask = toOf(decoder->GetDecoder().GetMask());
+			reliable = toOf(decoder->GetDecoder().GetReliable());
+			
+			horizontal.Write(ofToDataPath(rootDir[0] + "/h.map", true));
+			vertical.Write(ofToDataPath(rootDir[0] + "/v.map", true));
+			mask.saveImage(ofToDataPath(rootDir[0] + "/mask.png"));
+			reliable.saveImage(ofToDataPath(rootDir[0] + "/reliable.png"));
+			
+			decoding = false;
+		}
 		
 		camera.update();
-		curFrame.setFromPixels(camera.getPixelsRef());
-		curFrame.update();
 		
-		if( camera.isFrameNew() && needToCapture ) {
+		if( camera.isFrameNew() && !started ) {
+			// preview; the scan reads the camera pixels in place
+			curFrame.setFromPixels(camera.getPixelsRef());
+			curFrame.update();
+		} else if( camera.isFrameNew() ) {
+			FrameView frame = toAs(camera.getPixelsRef());
+			scheduler.update(frame, ofGetElapsedTimeMillis());
 			
-			if( !curPattern.isAllocated() ) { // first image
-				curFrame.saveImage(rootDir[0] + "/camPerspective.jpg");
-				
-				ofImage depthFrame;
-				depthFrame.setFromPixels(camera.getDepthPixelsRef());
-				depthFrame.saveImage(rootDir[0] + "/camPerspectiveDepth.png");
-				prevFrame = curFrame;
-			} else {
-				// see if 20% of image changed
-				if( difference(camera.getPixelsRef(), prevFrame.getPixelsRef()) < 20 / 3 ) {
-					return;
-				}
-				
-				decoder->AddImage(toAs(curFrame));
-				prevFrame = curFrame;
-				imageUpdateTrigger = false;
+			// the frame showing a pattern arrives a few frames after it is
+			// drawn; the scheduler tells which one it is
+			if( scheduler.getCapture() >= 0 && !decoder->AddImage(frame) ) {
+				scheduler.retry(); // decoder queue is full, show the pattern again
 			}
 			
-			if( !encoder->IsFinished() ) {
-				curPattern = toOf(encoder->GetImage());
-				encoder->Proceed();
-			} else {
-				while ( decoder->IsFinished() ); // wait while decoding
-				
-				Map2f horizontal, vertical;
-				ofImage mask, reliable;
-				
-				horizontal = decoder->GetHorizontal();
-				vertical = decoder->GetVertical();
-				mask = toOf(decoder->GetMask());
-				reliable = toOf(decoder->GetReliable());
-				
-				horizontal.Write(ofToDataPath(rootDir[0] + "/h.map", true));
-				vertical.Write(ofToDataPath(rootDir[0] + "/v.map", true));
-				mask.saveImage(ofToDataPath(rootDir[0] + "/mask.png"));
-				reliable.saveImage(ofToDataPath(rootDir[0] + "/reliable.png"));
-				
+			if( scheduler.isFinished() ) {
+				ofLogVerbose() << "scanned with latency " << scheduler.getLatency() << " frames, "
+					<< scheduler.getRestarts() << " restarts, "
+					<< decoder->GetDropped() << " frames refused by the decoder queue";
+				// the maps are saved once the worker has decoded them
+				decoding = true;
+				started = false;
+			} else if( scheduler.isFailed() ) {
+				ofLogWarning() << "flash not seen: is the camera aimed at the projection?";
 				started = false;
 			}
 		}
@@ -129,12 +126,15 @@ void ofApp::draw() {
 		
 		if( started ) {
 			ofSetColor(grayHigh);
-			if( curPattern.isAllocated() ) {
-				curPattern.draw(0, 0);
-				if( imageUpdateTrigger == false ) {
-					imageUpdateTrigger = true;
-					captureTime = ofGetSystemTime();
+			int display = scheduler.getDisplay();
+			if( display == CaptureScheduler::DISPLAY_WHITE ) {
+				ofRect(0, 0, ofGetWidth(), ofGetHeight());
+			} else if( display >= 0 ) {
+				if( display != curPatternId ) {
+					curPattern = toOf(encoder->GetCachedImage(display));
+					curPatternId = display;
 				}
+				curPattern.draw(0, 0);
 			}
 		} else if( ofGetWindowMode() != OF_FULLSCREEN ) {
 			curFrame.draw(0, 0);
@@ -148,7 +148,14 @@ void ofApp::keyPressed(int key) {
 		
 		if(key == ' ') {
 			started = true;
-			prevFrame.setFromPixels(camera.getPixelsRef());
+			curFrame.saveImage(rootDir[0] + "/camPerspective.jpg");
+			
+			ofImage depthFrame;
+			depthFrame.setFromPixels(camera.getDepthPixelsRef());
+			depthFrame.saveImage(rootDir[0] + "/camPerspectiveDepth.png");
+			
+			// the first scan flashes the projector to measure its latency
+			scheduler.start();
 		}
 		if( key == 'f' ) {
 			ofToggleFullscreen();
@@ -166,18 +173,3 @@ void ofApp::dragEvent(ofDragInfo dragInfo){
 		pathLoaded = true;
 	}
 }
-
-int ofApp::difference(ofPixels &p0, ofPixels &p1){
-	// subtract two images
-	ofPixels pout = p0;
-	int numChanged = 0;
-	int threshold = 3;
-	for (int i = 0; i < pout.size(); i++) {
-		pout[i] = ofMap(p0[i] - p1[i], -255, 255, 0, 255, true);
-		if (pout[i] < 128 - threshold || 128 + threshold < pout[i]) {
-			numChanged++;
-		}
-	}
-	
-	return numChanged * 100 / pout.size();
-}
@@ -35,25 +35,23 @@ public:
 	void draw();
 	void keyPressed(int);
 	void dragEvent(ofDragInfo);
-	int difference(ofPixels &p0, ofPixels &p1);
 	
 	vector<string> rootDir;
 	
 private:
 	ofxActiveScan::Options options;
 	ofxActiveScan::Encoder * encoder;
-	ofxActiveScan::Decoder * decoder;
+	ofxActiveScan::AsyncDecoder * decoder;
+	ofxActiveScan::CaptureScheduler scheduler;
 	
 	ofxKinect camera;
 	
 	int cw, ch;
 	int grayLow, grayHigh;
-	int bufferTime;
-	unsigned long captureTime;
-	bool started;
+	bool started, decoding;
 	ofImage curFrame;
-	ofImage prevFrame;
 	ofImage curPattern;
+	int curPatternId;
 	
-	bool pathLoaded, imageUpdateTrigger;
+	bool pathLoaded;
 };
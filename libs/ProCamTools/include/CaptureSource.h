@@ -0,0 +1,204 @@
+//
+// This file is part of ofxActiveScan.
+//
+// sources of camera frames for the decoder. CReplaySource plays back a
+// recorded pattern sequence from disk instead of a camera, at the rate of
+// the camera or as fast as it goes, and RunCapture() feeds any source into
+// a CAsyncDecode and measures the scan, so that the throughput of the whole
+// pipeline can be benchmarked and compared between builds without a
+// camera or a projector.
+//
+
+#pragma once
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include "Field.h"
+#include "FrameView.h"
+#include "ImageBmpIO.h"
+
+#include "decode_async.h"
+
+class CCaptureSource
+{
+public:
+	virtual ~CCaptureSource() {}
+
+	// wait for the next frame; false once the source has no more frames.
+	// the frame stays valid until the next call.
+	virtual bool Grab(slib::CFrameView& frame) = 0;
+
+	// frames the source delivers, or -1 if it does not know
+	virtual int GetNumFrames(void) const { return -1; }
+};
+
+// a recorded sequence of BMP files, one per frame in the order of CEncode,
+// as CDecode::Decode() reads them. frames are delivered top-down, in gray
+// or RGB(A) as a camera does, so color files are reduced to intensities by
+// CFrameView rather than by slib::image::Read().
+class CReplaySource : public CCaptureSource
+{
+public:
+	// replay 'files' at 'fps' frames per second, or as fast as they are
+	// taken with 0. with 'preload' all files are read here, so that the
+	// disk does not enter the measurement.
+	CReplaySource(const std::vector<std::string>& files, const double fps = 0, const bool preload = true)
+		: m_files(files), m_frames(files.size()), m_fps(fps), m_preload(preload), m_next(0)
+	{
+		if (m_preload)
+			for (size_t i = 0; i < m_files.size(); i++)
+				load(m_files[i], m_frames[i]);
+	}
+
+	void SetRate(const double fps) { m_fps = fps; }
+	double GetRate(void) const { return m_fps; }
+
+	// play from the first frame again
+	void Rewind(void) { m_next = 0; }
+
+	int GetNumFrames(void) const { return (int)m_files.size(); }
+
+	bool Grab(slib::CFrameView& frame)
+	{
+		if (m_next >= m_files.size())
+			return false;
+
+		// frame i is due i / fps seconds after the first
+		if (m_next == 0)
+			m_start = std::chrono::steady_clock::now();
+		else if (m_fps > 0)
+			std::this_thread::sleep_until(m_start + std::chrono::microseconds((long long)(m_next * 1e6 / m_fps)));
+
+		frame_t& f = m_frames[m_next];
+		if (!m_preload) {
+			// keep a single frame in memory
+			if (m_next > 0)
+				std::swap(f, m_frames[m_next - 1]);
+			load(m_files[m_next], f);
+		}
+		frame = slib::CFrameView(&f.pixels[0], f.width, f.height, f.channels);
+		m_next++;
+		return true;
+	}
+
+	// write an 8- or 16-bit gray or RGB(A) frame as a BMP file that can be
+	// replayed; 16-bit frames are written at 8 bits and alpha is dropped
+	static void Save(const slib::CFrameView& frame, const std::string& filename)
+	{
+		const int w = frame.size(0), h = frame.size(1);
+		const int channels = frame.channels() == 1 ? 1 : 3;
+		slib::image::CBmpImage bmp(w, h, channels);
+		for (int y = 0; y < h; y++) {
+			const unsigned char *row = frame.data() + (size_t)y * frame.stride();
+			for (int x = 0; x < w; x++)
+				for (int c = 0; c < channels; c++) {
+					int i = x * frame.channels() + c;
+					bmp.pixel(x, y, c) = frame.depth() == 8 ? row[i] : (unsigned char)(reinterpret_cast<const unsigned short *>(row)[i] >> 8);
+				}
+		}
+		bmp.WriteBmp(filename);
+	}
+
+private:
+	struct frame_t {
+		frame_t() : width(0), height(0), channels(0) {}
+		std::vector<unsigned char> pixels;
+		int width, height, channels;
+	};
+
+	// tightly packed, top-down RGB(A) pixels of a BMP file, whose rows are
+	// bottom-up BGR(A) padded to 4 bytes
+	static void load(const std::string& filename, frame_t& f)
+	{
+		slib::image::CBmpImage bmp;
+		if (!bmp.LoadBmp(filename))
+			slib::ThrowRuntimeError("failed to open %s", filename.c_str());
+		f.width = bmp.GetWidth();
+		f.height = bmp.GetHeight();
+		f.channels = bmp.GetNumChannels();
+		const int rowsize = f.width * f.channels;
+		const int pitch = rowsize + (4 - rowsize % 4) % 4;
+		f.pixels.resize((size_t)rowsize * f.height);
+		for (int y = 0; y < f.height; y++) {
+			const unsigned char *src = bmp.pixel_ptr() + (size_t)(f.height - 1 - y) * pitch;
+			unsigned char *dst = &f.pixels[(size_t)y * rowsize];
+			std::copy(src, src + rowsize, dst);
+			if (f.channels >= 3)
+				for (int x = 0; x < rowsize; x += f.channels)
+					std::swap(dst[x], dst[x + 2]);
+		}
+	}
+
+private:
+	std::vector<std::string> m_files;
+	std::vector<frame_t> m_frames;
+	double m_fps;
+	bool m_preload;
+	size_t m_next; // frame of the next Grab()
+	std::chrono::steady_clock::time_point m_start; // of the first frame
+};
+
+// how a scan went through the pipeline. times are in seconds.
+struct capture_stats_t {
+	capture_stats_t() : frames(0), retries(0), seconds(0), fps(0), finish(0), finished(false) {}
+	int frames; // frames passed to the decoder
+	int retries; // times a frame waited for a full decoder queue
+	double seconds; // from the first Grab() to the decoded maps
+	double fps; // frames per second over 'seconds'
+	CAsyncDecode::stage_time_t grab; // waiting for and reading a frame
+	CAsyncDecode::stage_time_t submit; // queueing it, waits for a full queue included
+	CAsyncDecode::stage_time_t queue; // in the queue
+	CAsyncDecode::stage_time_t decode; // in the decoder
+	double finish; // from the last frame queued to the decoded maps
+	bool finished; // false if the scan was rejected or the source ran out
+};
+
+// pass every frame of 'source' to 'decoder' and wait for the maps. a frame
+// that finds the queue full waits until it gets in, so that a replayed scan
+// is decoded the same way however fast the machine is; 'retries' tells how
+// often a camera would have dropped a frame there.
+inline
+capture_stats_t RunCapture(CCaptureSource& source, CAsyncDecode& decoder)
+{
+	typedef std::chrono::steady_clock clock;
+	capture_stats_t stats;
+	slib::CFrameView frame;
+	const clock::time_point start = clock::now();
+	unsigned long long queued = CAsyncDecode::GetTime();
+
+	while (stats.frames < decoder.GetNumImages() && !decoder.IsRejected()) {
+		clock::time_point t0 = clock::now();
+		if (!source.Grab(frame))
+			break;
+		clock::time_point t1 = clock::now();
+		while (!decoder.AddImage(frame)) {
+			if (decoder.IsRejected())
+				break;
+			stats.retries++;
+			std::this_thread::yield();
+		}
+		queued = CAsyncDecode::GetTime();
+		stats.grab.add(std::chrono::duration<double>(t1 - t0).count());
+		stats.submit.add(std::chrono::duration<double>(clock::now() - t1).count());
+		stats.frames++;
+	}
+
+	if (stats.frames == decoder.GetNumImages() || decoder.IsRejected()) {
+		decoder.GetResult().wait();
+		stats.finished = decoder.IsFinished();
+	}
+	stats.seconds = std::chrono::duration<double>(clock::now() - start).count();
+	stats.fps = stats.seconds > 0 ? stats.frames / stats.seconds : 0;
+
+	CAsyncDecode::timing_t timing = decoder.GetTiming();
+	stats.queue = timing.queue;
+	stats.decode = timing.decode;
+	if (timing.finished > queued)
+		stats.finish = (timing.finished - queued) * 1e-6;
+	return stats;
+}
@@ -0,0 +1,156 @@
+//
+// This file is part of ofxActiveScan.
+//
+// color-multiplexed pattern sequences.
+// the R, G and B channels of each projected frame carry three images of
+// the sequence, so a color camera captures it in a third of the frames.
+// image j of n images is channel j / m of frame j % m, m = ceil(n / 3):
+// complementary pairs and the shifts of a fringe land in one channel, so
+// the surface color does not bias their comparison.
+// the channels of the projector leak into every channel of the camera;
+// CColorCrosstalk measures that mixing once per installation, and the
+// decoder unmixes each frame back into its three images.
+//
+
+#pragma once
+
+#include <vector>
+#include <fstream>
+#include <cmath>
+#include <algorithm>
+
+#include "Field.h"
+#include "FrameView.h"
+#include "MiscUtil.h"
+
+// projected frames that carry 'nimages' images
+inline
+int GetNumColorFrames(const int nimages)
+{
+	return (nimages + 2) / 3;
+}
+
+// image carried by channel 'c' of 'frame', or -1 for a black channel
+inline
+int GetColorPlane(const int nimages, const int frame, const int c)
+{
+	int j = c * GetNumColorFrames(nimages) + frame;
+	return j < nimages ? j : -1;
+}
+
+// images carried by rows [y0,y1) of 'frame'.
+// plane[k] = sum of unmix(k,c) * channel c; 'plane' must be initialized to
+// the size of 'frame'.
+inline
+void UnmixColorFrame(const slib::CFrameView& frame, const slib::CMatrix<3,3,float>& unmix, slib::Field<2,float> *plane, const int y0, const int y1)
+{
+	const int w = frame.size(0);
+	std::vector<float> buffer(3 * w);
+	float *r = &buffer[0], *g = r + w, *b = g + w;
+	for (int y = y0; y < y1; y++) {
+		frame.GetRow(y, 0, w, 0, r);
+		frame.GetRow(y, 0, w, 1, g);
+		frame.GetRow(y, 0, w, 2, b);
+		for (int k = 0; k < 3; k++) {
+			const float u0 = unmix(k,0), u1 = unmix(k,1), u2 = unmix(k,2);
+			float *dst = plane[k].ptr() + (size_t)y * w;
+			for (int x = 0; x < w; x++)
+				dst[x] = u0 * r[x] + u1 * g[x] + u2 * b[x];
+		}
+	}
+}
+
+// crosstalk between the channels of the projector and the camera.
+// project the black, red, green and blue frames of GetImage() and add the
+// captured frames; the camera must not saturate.
+class CColorCrosstalk
+{
+public:
+	enum { NUM_IMAGES = 4 }; // black, red, green and blue
+
+	CColorCrosstalk()
+	{
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+				m_mixing(i,j) = i == j;
+		for (int id = 0; id < NUM_IMAGES; id++)
+			m_mean[id] = slib::make_vector(0.0, 0.0, 0.0);
+	}
+
+	// 'id'-th calibration frame.
+	// 'image' must be initialized to the projector size.
+	static void GetImage(int id, slib::Field<2,slib::CVector<3,unsigned char> >& image)
+	{
+		slib::CVector<3,unsigned char> color = slib::make_vector<unsigned char>(0, 0, 0);
+		if (id > 0)
+			color[id - 1] = 255;
+		image.Clear(color);
+	}
+
+	// add the capture of the 'id'-th calibration frame.
+	// the mixing is updated once the last frame is added.
+	void AddImage(int id, const slib::CFrameView& frame)
+	{
+		const int w = frame.size(0);
+		std::vector<float> row(w);
+		slib::CVector<3,double> sum = slib::make_vector(0.0, 0.0, 0.0);
+		for (int c = 0; c < 3; c++) {
+			for (int y = 0; y < frame.size(1); y++) {
+				frame.GetRow(y, 0, w, c, &row[0]);
+				for (int x = 0; x < w; x++)
+					sum[c] += row[x];
+			}
+		}
+		m_mean[id] = sum / ((double)w * frame.size(1));
+
+		if (id == NUM_IMAGES - 1) {
+			for (int k = 0; k < 3; k++)
+				for (int c = 0; c < 3; c++)
+					m_mixing(c,k) = m_mean[k + 1][c] - m_mean[0][c];
+		}
+	}
+
+	// response of camera channel c to projector channel k, (c,k).
+	// only the ratios matter, as unlit pixels are averaged in.
+	const slib::CMatrix<3,3,double>& GetMixing(void) const { return m_mixing; }
+	void SetMixing(const slib::CMatrix<3,3,double>& mixing) { m_mixing = mixing; }
+
+	// matrix taking camera channels to projector channels, scaled so that
+	// every image is as bright as the weakest channel of the camera
+	slib::CMatrix<3,3,float> GetUnmixing(void) const
+	{
+		const slib::CMatrix<3,3,double>& m = m_mixing;
+		double gain = std::min(std::min(m(0,0), m(1,1)), m(2,2));
+		if (gain <= 0 || std::abs(slib::determinant_of(m)) < 1e-6 * gain * gain * gain)
+			slib::ThrowRuntimeError("color crosstalk is singular");
+
+		slib::CMatrix<3,3,double> inverse = slib::inverse_of(m) * gain;
+		slib::CMatrix<3,3,float> u;
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+				u(i,j) = (float)inverse(i,j);
+		return u;
+	}
+
+	void Write(const std::string& filename) const
+	{
+		std::ofstream out(filename.c_str());
+		for (int i = 0; i < 3; i++)
+			out << m_mixing(i,0) << " " << m_mixing(i,1) << " " << m_mixing(i,2) << "\n";
+		if (!out)
+			slib::ThrowRuntimeError("failed to open %s", filename.c_str());
+	}
+
+	void Read(const std::string& filename)
+	{
+		std::ifstream in(filename.c_str());
+		for (int i = 0; i < 3; i++)
+			in >> m_mixing(i,0) >> m_mixing(i,1) >> m_mixing(i,2);
+		if (!in)
+			slib::ThrowRuntimeError("failed to read %s", filename.c_str());
+	}
+
+private:
+	slib::CMatrix<3,3,double> m_mixing;
+	slib::CVector<3,double> m_mean[NUM_IMAGES]; // mean of each channel of each frame
+};
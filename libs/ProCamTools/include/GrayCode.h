@@ -8,10 +8,19 @@
 #pragma once
 
 #include <cmath>
+#include <cstring>
+#include <limits>
+
+#include <vector>
 
 #include "Field.h" // for GetPseudoInverse()
+#include "FrameView.h"
+#include "RowSpans.h"
+#include "FrameStack.h"
+#include "TileHistogram.h"
 #include "MathBaseLapack.h" // for GetPseudoInverse()
 #include "ColorConv.h"
+#include "Simd.h"
 
 namespace slib
 {
@@ -21,77 +30,267 @@ namespace slib
 //------------------------------------------------------------
 
 namespace {
+// each binary bit is the XOR of all gray-code bits above it
+inline
+unsigned int ConvertGrayToBinary(unsigned int graycode)
+{
+	graycode ^= graycode >> 1;
+	graycode ^= graycode >> 2;
+	graycode ^= graycode >> 4;
+	graycode ^= graycode >> 8;
+	graycode ^= graycode >> 16;
+	return graycode;
+}
+
+// bits of 'nbits'-bit code words above 'level'
+inline
+unsigned int GetXorMask(const int level, const int nbits)
+{
+	return ((1u << nbits) - 1) & ~((2u << level) - 1);
+}
+
+// XOR-coded words into gray code: the bits above 'level' were XORed with
+// bit 'level' by the pattern, so they are flipped where it is set.
+// 'high' is GetXorMask(level, nbits).
+inline
+unsigned int ConvertXorToGray(const unsigned int code, const int level, const unsigned int high)
+{
+	return code ^ (high & (0u - ((code >> level) & 1)));
+}
+
+#if defined(SLIB_SIMD_SSE2)
+inline
+simd::vint ConvertXorToGray(const simd::vint code, const int level, const unsigned int high)
+{
+	simd::vint bit = simd::andi(simd::srli(code, level), simd::set1i(1));
+	return simd::xori(code, simd::andi(simd::subi(simd::set1i(0), bit), simd::set1i(high)));
+}
+#endif
+
+inline
+void ConvertXorToGray(unsigned int *code, const int level, const unsigned int high, const int n)
+{
+	int x = 0;
+#if defined(SLIB_SIMD_SSE2)
+	for (; x + simd::width <= n; x += simd::width)
+		simd::storei(code + x, ConvertXorToGray(simd::loadi(code + x), level, high));
+#endif
+	for (; x < n; x++)
+		code[x] = ConvertXorToGray(code[x], level, high);
+}
+
+// set bit 'level' of the code words where a > b
+inline
+void PackGrayCodeBits(const float *a, const float *b, const int level, unsigned int *code, const int n)
+{
+	int x = 0;
+#if defined(SLIB_SIMD_SSE2)
+	const simd::vint bit = simd::set1i(1 << level);
+	for (; x + simd::width <= n; x += simd::width) {
+		simd::vfloat gt = simd::cmpgt(simd::load(a + x), simd::load(b + x));
+		simd::vint c = simd::ori(simd::loadi(code + x), simd::andi(simd::as_int(gt), bit));
+		simd::storei(code + x, c);
+	}
+#endif
+	for (; x < n; x++)
+		if (a[x] > b[x])
+			code[x] |= 1u << level;
+}
+
+// set bit 'level' of the code words where a > b, and count the pixels
+// where |a-b| < threshold in 'uncertainty', in a single pass
+inline
+void AccumulateGrayCodeBits(const float *a, const float *b, const int level, const float threshold, unsigned int *code, int *uncertainty, const int n)
+{
+	int x = 0;
+#if defined(SLIB_SIMD_SSE2)
+	const simd::vint bit = simd::set1i(1 << level);
+	const simd::vfloat thr = simd::set1(threshold);
+	for (; x + simd::width <= n; x += simd::width) {
+		simd::vfloat d = simd::sub(simd::load(a + x), simd::load(b + x));
+		simd::vfloat gt = simd::cmpgt(d, simd::zero());
+		simd::vfloat uncertain = simd::cmplt(simd::abs(d), thr);
+		simd::storei(code + x, simd::ori(simd::loadi(code + x), simd::andi(simd::as_int(gt), bit)));
+		// the comparison mask is -1 where uncertain
+		simd::storei(uncertainty + x, simd::subi(simd::loadi(uncertainty + x), simd::as_int(uncertain)));
+	}
+#endif
+	for (; x < n; x++) {
+		float d = a[x] - b[x];
+		if (d > 0)
+			code[x] |= 1u << level;
+		if (std::abs(d) < threshold)
+			uncertainty[x]++;
+	}
+}
+
+// maximum of 'm' and a row of values
 inline
-int ConvertGrayToBinary(const unsigned long graycode)
+float GetRowMax(const float *a, const int n, float m)
 {
-	int bincode = 0;
-	int mask = 1;
-	while (mask < graycode)
-		mask *= 2;
-	for (; mask; mask /= 2)
-		bincode += (mask & graycode) ^ (mask & (bincode / 2));
-	return bincode;
+	int x = 0;
+#if defined(SLIB_SIMD_SSE2)
+	if (n >= simd::width) {
+		simd::vfloat vm = simd::load(a);
+		for (x = simd::width; x + simd::width <= n; x += simd::width)
+			vm = simd::max(vm, simd::load(a + x));
+		float lane[simd::width];
+		simd::store(lane, vm);
+		for (int i = 0; i < simd::width; i++)
+			m = std::max(m, lane[i]);
+	}
+#endif
+	for (; x < n; x++)
+		m = std::max(m, a[x]);
+	return m;
+}
+
+// convert a row of gray-code words into binary code
+inline
+void ConvertGrayToBinary(const unsigned int *code, float *result, const int n)
+{
+	int x = 0;
+#if defined(SLIB_SIMD_SSE2)
+	for (; x + simd::width <= n; x += simd::width) {
+		simd::vint g = simd::loadi(code + x);
+		g = simd::xori(g, simd::srli(g, 1));
+		g = simd::xori(g, simd::srli(g, 2));
+		g = simd::xori(g, simd::srli(g, 4));
+		g = simd::xori(g, simd::srli(g, 8));
+		g = simd::xori(g, simd::srli(g, 16));
+		simd::store(result + x, simd::to_float(g));
+	}
+#endif
+	for (; x < n; x++)
+		result[x] = ConvertGrayToBinary(code[x]);
 }
 } // unnamed namespace
 
+// fill 'bmp' with 'profile', the values along x (direction 0) or y
+// (direction 1) of a pattern that varies along one axis only.
+// rows are written in memory order, copied from 'profile' or filled.
+inline 
+void ExpandProfile(const int direction, const unsigned char *profile, Field<2,unsigned char> &bmp)
+{
+	const int w = bmp.size(0);
+	for (int y = 0; y < bmp.size(1); y++) {
+		unsigned char *dst = bmp.ptr() + (size_t)y * w;
+		if (direction == 0)
+			memcpy(dst, profile, w);
+		else
+			memset(dst, profile[y], w);
+	}
+}
+
+// a single bit plane of gray-code pattern over 'size' pixels
+inline 
+void GenerateGrayCodeProfile(const int level, const int size, std::vector<unsigned char> &profile, bool cmpl = false)
+{
+	profile.resize(size);
+	for (int i = 0; i < size; i++) {
+		int gray = i ^ (i >> 1);
+		int bit = (gray >> level) & 1;
+		profile[i] = (bit != (int)cmpl) ? 255 : 0;
+	}
+}
+
 // generate a single bit plane of gray-code pattern
 inline 
 void GenerateGrayCodeImage(const int direction, const int level, Field<2,unsigned char> &bmp, bool cmpl = false)
 {
-	if( direction == 0 ) {
-		for (int x = 0; x < bmp.size(0); x++)
-		{
-			int binary = x;
-			int gray = binary ^ (binary >> 1);
-			unsigned char coded;
-			if( !cmpl ) {
-				coded = (gray & (1 << level)) ? 255 : 0;
-			} else {
-				coded = (gray & (1 << level)) ? 0 : 255;
-			}
-			for (int y = 0; y < bmp.size(1); y++)
-			{
-				bmp.cell(x, y) = coded;
-			}
-		}
-	} else {
-		for (int y = 0; y < bmp.size(1); y++)
-		{
-			int binary = y;
-			int gray = binary ^ (binary >> 1);
-			unsigned char coded;
-			if( !cmpl ) {
-				coded = (gray & (1 << level)) ? 255 : 0;
-			} else {
-				coded = (gray & (1 << level)) ? 0 : 255;
-			}
-			for (int x = 0; x < bmp.size(0); x++)
-			{
-				bmp.cell(x, y) = coded;
-			}
-		}
+	std::vector<unsigned char> profile;
+	GenerateGrayCodeProfile(level, bmp.size(direction), profile, cmpl);
+	ExpandProfile(direction, &profile[0], bmp);
+}
+
+// a bit plane of an XOR code over 'size' pixels.
+// levels above 'base' are the gray-code level XORed with the fine level
+// 'base', so that every plane is made of narrow stripes, which keeps
+// global illumination from blurring the coarse bits. levels up to 'base'
+// are plain gray code.
+inline 
+void GenerateXorCodeProfile(const int level, const int base, const int size, std::vector<unsigned char> &profile, bool cmpl = false)
+{
+	profile.resize(size);
+	for (int i = 0; i < size; i++) {
+		int gray = i ^ (i >> 1);
+		int bit = (gray >> level) & 1;
+		if (level > base)
+			bit ^= (gray >> base) & 1;
+		profile[i] = (bit != (int)cmpl) ? 255 : 0;
+	}
+}
+
+// generate a bit plane of an XOR code
+inline 
+void GenerateXorCodeImage(const int direction, const int level, const int base, Field<2,unsigned char> &bmp, bool cmpl = false)
+{
+	std::vector<unsigned char> profile;
+	GenerateXorCodeProfile(level, base, bmp.size(direction), profile, cmpl);
+	ExpandProfile(direction, &profile[0], bmp);
+}
+
+// turn XOR-coded words of 'nbits' bits with base level 'base' back into
+// gray code, in the pixels of 'spans' in rows [y0,y1)
+inline 
+void DecodeXorCode(Field<2,unsigned int>& code, const int base, const int nbits, const CRowSpans& spans, const int y0, const int y1)
+{
+	const int w = code.size(0);
+	const unsigned int high = GetXorMask(base, nbits);
+	for (int y = y0; y < y1; y++) {
+		const CRowSpans::row_t& r = spans.row(y);
+		for (size_t i = 0; i < r.size(); i++)
+			ConvertXorToGray(code.ptr() + y * w + r[i].x0, base, high, r[i].x1 - r[i].x0);
+	}
+}
+
+// decode gray-code words into binary code in rows [y0,y1).
+// 'result' must be initialized to the size of 'code'.
+inline 
+void DecodeGrayCode(const Field<2,unsigned int>& code, Field<2,float>& result, const int y0, const int y1)
+{
+	const int w = code.size(0);
+	for (int y = y0; y < y1; y++)
+		ConvertGrayToBinary(code.ptr() + y * w, result.ptr() + y * w, w);
+}
+
+// decode the pixels of 'spans' in rows [y0,y1)
+inline 
+void DecodeGrayCode(const Field<2,unsigned int>& code, Field<2,float>& result, const CRowSpans& spans, const int y0, const int y1)
+{
+	const int w = code.size(0);
+	for (int y = y0; y < y1; y++) {
+		const CRowSpans::row_t& r = spans.row(y);
+		for (size_t i = 0; i < r.size(); i++)
+			ConvertGrayToBinary(code.ptr() + y * w + r[i].x0, result.ptr() + y * w + r[i].x0, r[i].x1 - r[i].x0);
 	}
 }
 
+inline 
+void DecodeGrayCode(const Field<2,unsigned int>& code, Field<2,float>& result)
+{
+	result.Initialize(code.size());
+	DecodeGrayCode(code, result, 0, code.size(1));
+}
+
+// 'bmps[l]' is the signed difference of the complementary pair of level 'l'
 inline 
 void DecodeGrayCodeImages(const std::vector<Field<2,float> >& bmps, Field<2,float>& result)
 {
 	int nlevels = bmps.size();
 	const CVector<2,int>& size = bmps[0].size();
+	const int w = size[0];
 
-	// load binary codes
-	Field<2, unsigned long> binary(size, 0);
-	for (int l=0; l<nlevels; l++)
-		for (int y = 0; y < size[1]; y++)
-			for (int x = 0; x < size[0]; x++)
-				if (bmps[l].cell(x, y) > 0)
-					binary.cell(x, y) += (1 << l);
-
-	// decode
+	// pack the sign bits of all levels row by row, then decode the row
+	std::vector<unsigned int> code(w);
+	std::vector<float> zero(w, 0.0f);
 	result.Initialize(size);
-	for (int y = 0; y < size[1]; y++)
-		for (int x = 0; x < size[0]; x++)
-			result.cell(x, y) = ConvertGrayToBinary(binary.cell(x, y));
+	for (int y = 0; y < size[1]; y++) {
+		std::fill(code.begin(), code.end(), 0);
+		for (int l=0; l<nlevels; l++)
+			PackGrayCodeBits(bmps[l].ptr() + y * w, &zero[0], l, &code[0], w);
+		ConvertGrayToBinary(&code[0], result.ptr() + y * w, w);
+	}
 }
 
 // update valid region by thresholding
@@ -104,61 +303,1043 @@ void CountGraycodeUncertainty(const Field<2,float> &diff, const float threshold,
 				uncertainty.cell(x, y)++;
 }
 
+// maximum intensity in rows [y0,y1)
+inline
+float GetImageMax(const Field<2,float> &image, const int y0, const int y1)
+{
+	const int w = image.size(0);
+	return GetRowMax(image.ptr() + y0 * w, (y1 - y0) * w, -std::numeric_limits<float>::max());
+}
+
+inline
+float GetImageMax(const CFrameView &image, const int y0, const int y1)
+{
+	return image.max(y0, y1);
+}
+
+// maximum intensity of the pixels of 'spans' in rows [y0,y1)
+inline
+float GetImageMax(const Field<2,float> &image, const CRowSpans& spans, const int y0, const int y1)
+{
+	const int w = image.size(0);
+	float m = -std::numeric_limits<float>::max();
+	for (int y = y0; y < y1; y++) {
+		const CRowSpans::row_t& r = spans.row(y);
+		for (size_t i = 0; i < r.size(); i++)
+			m = GetRowMax(image.ptr() + y * w + r[i].x0, r[i].x1 - r[i].x0, m);
+	}
+	return m;
+}
+
+inline
+float GetImageMax(const CFrameView &image, const CRowSpans& spans, const int y0, const int y1)
+{
+	float m = -std::numeric_limits<float>::max();
+	for (int y = y0; y < y1; y++) {
+		const CRowSpans::row_t& r = spans.row(y);
+		for (size_t i = 0; i < r.size(); i++)
+			m = std::max(m, image.GetRowMax(y, r[i].x0, r[i].x1));
+	}
+	return m;
+}
+
+// copy rows [y0,y1) of 'image' into 'result' and return their maximum,
+// so that the first image of a complementary pair is read only once.
+// 'result' must be initialized to the size of 'image'.
+template <typename image_t> inline 
+float CopyImageRows(const image_t &image, Field<2,float> &result, const int y0, const int y1)
+{
+	const int w = image.size(0);
+	float m = -std::numeric_limits<float>::max();
+	for (int y = y0; y < y1; y++) {
+		float *dst = result.ptr() + y * w;
+		const float *src = GetRow(image, y, dst);
+		if (src != dst)
+			std::copy(src, src + w, dst);
+		m = GetRowMax(dst, w, m);
+	}
+	return m;
+}
+
+// copy the pixels of 'spans' in rows [y0,y1) and return their maximum
+template <typename image_t> inline 
+float CopyImageRows(const image_t &image, Field<2,float> &result, const CRowSpans& spans, const int y0, const int y1)
+{
+	const int w = image.size(0);
+	float m = -std::numeric_limits<float>::max();
+	for (int y = y0; y < y1; y++) {
+		const CRowSpans::row_t& r = spans.row(y);
+		float *dst = result.ptr() + y * w;
+		for (size_t i = 0; i < r.size(); i++) {
+			const float *src = GetRow(image, y, r[i].x0, r[i].x1, dst);
+			if (src != dst)
+				std::copy(src + r[i].x0, src + r[i].x1, dst + r[i].x0);
+			m = GetRowMax(dst + r[i].x0, r[i].x1 - r[i].x0, m);
+		}
+	}
+	return m;
+}
+
+// fold a complementary pair of a single bit plane into gray-code words
+// in rows [y0,y1).
+// equivalent to DecodeGrayCodeImages() and CountGraycodeUncertainty() 
+// applied to 'image'-'cmpl', but the difference, its sign and the
+// uncertainty are computed in one pass without keeping the bit planes.
+// 'cmpl' may be a float image or a CFrameView.
+template <typename image_t> inline 
+void AccumulateGrayCodePair(const Field<2,float> &image, const image_t &cmpl, const int level, const float threshold, Field<2,unsigned int> &code, Field<2,int> &uncertainty, const int y0, const int y1)
+{
+	const int w = image.size(0);
+	std::vector<float> buffer(w);
+	for (int y = y0; y < y1; y++) {
+		const float *a = image.ptr() + y * w;
+		const float *b = GetRow(cmpl, y, &buffer[0]);
+		AccumulateGrayCodeBits(a, b, level, threshold, code.ptr() + y * w, uncertainty.ptr() + y * w, w);
+	}
+}
+
+// fold the pixels of 'spans' in rows [y0,y1)
+template <typename image_t> inline 
+void AccumulateGrayCodePair(const Field<2,float> &image, const image_t &cmpl, const int level, const float threshold, Field<2,unsigned int> &code, Field<2,int> &uncertainty, const CRowSpans& spans, const int y0, const int y1)
+{
+	const int w = image.size(0);
+	std::vector<float> buffer(w);
+	for (int y = y0; y < y1; y++) {
+		const CRowSpans::row_t& r = spans.row(y);
+		for (size_t i = 0; i < r.size(); i++) {
+			const int x0 = r[i].x0, offset = y * w + x0;
+			const float *b = GetRow(cmpl, y, x0, r[i].x1, &buffer[0]);
+			AccumulateGrayCodeBits(image.ptr() + offset, b + x0, level, threshold, code.ptr() + offset, uncertainty.ptr() + offset, r[i].x1 - x0);
+		}
+	}
+}
+
+// fold the pixels of 'spans' in rows [y0,y1), where the threshold of each
+// tile is 'threshold' times its level in 'levels'
+template <typename image_t> inline 
+void AccumulateGrayCodePair(const Field<2,float> &image, const image_t &cmpl, const int level, const float threshold, const CTileHistogram &levels, Field<2,unsigned int> &code, Field<2,int> &uncertainty, const CRowSpans& spans, const int y0, const int y1)
+{
+	const int w = image.size(0);
+	std::vector<float> buffer(w);
+	for (int y = y0; y < y1; y++) {
+		const CRowSpans::row_t& r = spans.row(y);
+		for (size_t i = 0; i < r.size(); i++) {
+			const float *b = GetRow(cmpl, y, r[i].x0, r[i].x1, &buffer[0]);
+			levels.ForEachTile(y, r[i].x0, r[i].x1, [&](int x0, int x1, float t) {
+				const int offset = y * w + x0;
+				AccumulateGrayCodeBits(image.ptr() + offset, b + x0, level, threshold * t, code.ptr() + offset, uncertainty.ptr() + offset, x1 - x0);
+			});
+		}
+	}
+}
+
+template <typename image_t> inline 
+void AccumulateGrayCodePair(const Field<2,float> &image, const image_t &cmpl, const int level, const float threshold, Field<2,unsigned int> &code, Field<2,int> &uncertainty)
+{
+	AccumulateGrayCodePair(image, cmpl, level, threshold, code, uncertainty, 0, image.size(1));
+}
+
+// sum of |image-cmpl| over the pixels of 'spans' in rows [y0,y1) where it
+// reaches 'threshold', which are counted in 'count'.
+// 'cmpl' may be a float image or a CFrameView.
+template <typename image_t> inline 
+double SumGrayCodeContrast(const Field<2,float> &image, const image_t &cmpl, const float threshold, int &count, const CRowSpans& spans, const int y0, const int y1)
+{
+	const int w = image.size(0);
+	std::vector<float> buffer(w);
+	double sum = 0;
+	count = 0;
+	for (int y = y0; y < y1; y++) {
+		const CRowSpans::row_t& r = spans.row(y);
+		for (size_t i = 0; i < r.size(); i++) {
+			const float *a = image.ptr() + y * w;
+			const float *b = GetRow(cmpl, y, r[i].x0, r[i].x1, &buffer[0]);
+			for (int x = r[i].x0; x < r[i].x1; x++) {
+				float d = std::abs(a[x] - b[x]);
+				if (d >= threshold) {
+					sum += d;
+					count++;
+				}
+			}
+		}
+	}
+	return sum;
+}
+
+// fold a single bit plane, thresholded against the per-pixel intensity
+// 'middle' instead of a complementary image, in the pixels of 'spans' in
+// rows [y0,y1).
+// pixels where |image-middle| < threshold are counted as uncertain.
+template <typename image_t> inline 
+void AccumulateGrayCodeLevel(const image_t &image, const Field<2,float> &middle, const int level, const float threshold, Field<2,unsigned int> &code, Field<2,int> &uncertainty, const CRowSpans& spans, const int y0, const int y1)
+{
+	const int w = image.size(0);
+	std::vector<float> buffer(w);
+	for (int y = y0; y < y1; y++) {
+		const CRowSpans::row_t& r = spans.row(y);
+		for (size_t i = 0; i < r.size(); i++) {
+			const int x0 = r[i].x0, offset = y * w + x0;
+			const float *a = GetRow(image, y, x0, r[i].x1, &buffer[0]);
+			AccumulateGrayCodeBits(a + x0, middle.ptr() + offset, level, threshold, code.ptr() + offset, uncertainty.ptr() + offset, r[i].x1 - x0);
+		}
+	}
+}
+
+// fold the pixels of 'spans' in rows [y0,y1), where the threshold of each
+// tile is 'threshold' times its level in 'levels'
+template <typename image_t> inline 
+void AccumulateGrayCodeLevel(const image_t &image, const Field<2,float> &middle, const int level, const float threshold, const CTileHistogram &levels, Field<2,unsigned int> &code, Field<2,int> &uncertainty, const CRowSpans& spans, const int y0, const int y1)
+{
+	const int w = image.size(0);
+	std::vector<float> buffer(w);
+	for (int y = y0; y < y1; y++) {
+		const CRowSpans::row_t& r = spans.row(y);
+		for (size_t i = 0; i < r.size(); i++) {
+			const float *a = GetRow(image, y, r[i].x0, r[i].x1, &buffer[0]);
+			levels.ForEachTile(y, r[i].x0, r[i].x1, [&](int x0, int x1, float t) {
+				const int offset = y * w + x0;
+				AccumulateGrayCodeBits(a + x0, middle.ptr() + offset, level, threshold * t, code.ptr() + offset, uncertainty.ptr() + offset, x1 - x0);
+			});
+		}
+	}
+}
+
+// decode the complementary pairs in frames [first,first+2*nbits) of
+// 'stack', most significant bit first, in rows [y0,y1).
+// 'threshold' is relative to the maximum of each pair, as in
+// AccumulateGrayCodePair().
+// 'result' and 'uncertainty' must be initialized to the size of 'stack'.
+// 'xor_base' is the base level of XOR-coded frames, or -1 for gray code.
+// with 'levels' the threshold is relative to the level of each tile
+// instead, whose size must be a multiple of CFrameStack::BLOCK.
+inline 
+void DecodeGrayCodeStack(const CFrameStack &stack, const int first, const int nbits, const float threshold, Field<2,float>& result, Field<2,int>& uncertainty, const int y0, const int y1, const int xor_base = -1, const CTileHistogram *levels = 0)
+{
+	const unsigned int high = xor_base < 0 ? 0 : GetXorMask(xor_base, nbits);
+	std::vector<float> thresholds(nbits);
+	for (int b = 0; b < nbits; b++)
+		thresholds[b] = threshold * std::max(stack.GetMax(first + 2 * b), stack.GetMax(first + 2 * b + 1));
+
+	std::vector<float> tiled(nbits);
+
+	const int w = stack.size(0);
+	const int B = CFrameStack::BLOCK;
+	for (int y = y0; y < y1; y++) {
+		float *dst = result.ptr() + y * w;
+		int *u = uncertainty.ptr() + y * w;
+		for (int x = 0; x < w; x += B) {
+			const unsigned short *p = stack.block(x, y) + first * B;
+			const float *th = &thresholds[0];
+			if (levels) {
+				std::fill(tiled.begin(), tiled.end(), threshold * 65535 * levels->GetLevel(x, y));
+				th = &tiled[0];
+			}
+			int i = 0;
+#if defined(SLIB_SIMD_SSE2)
+			for (; i + simd::width <= B && x + i + simd::width <= w; i += simd::width) {
+				simd::vint c = simd::set1i(0), n = simd::set1i(0);
+				for (int b = 0; b < nbits; b++) {
+					simd::vfloat d = simd::sub(simd::load_u16(p + 2 * b * B + i), simd::load_u16(p + (2 * b + 1) * B + i));
+					simd::vfloat gt = simd::cmpgt(d, simd::zero());
+					c = simd::ori(c, simd::andi(simd::as_int(gt), simd::set1i(1 << (nbits - 1 - b))));
+					n = simd::subi(n, simd::as_int(simd::cmplt(simd::abs(d), simd::set1(th[b]))));
+				}
+				if (high)
+					c = ConvertXorToGray(c, xor_base, high);
+				unsigned int code[simd::width];
+				simd::storei(code, c);
+				simd::storei(u + x + i, n);
+				ConvertGrayToBinary(code, dst + x + i, simd::width);
+			}
+#endif
+			for (; i < B && x + i < w; i++) {
+				unsigned int code = 0;
+				int count = 0;
+				for (int b = 0; b < nbits; b++) {
+					int d = (int)p[2 * b * B + i] - (int)p[(2 * b + 1) * B + i];
+					code |= (d > 0) << (nbits - 1 - b);
+					count += std::abs(d) < th[b];
+				}
+				if (high)
+					code = ConvertXorToGray(code, xor_base, high);
+				dst[x + i] = ConvertGrayToBinary(code);
+				u[x + i] = count;
+			}
+		}
+	}
+}
+
+// decode the single bit planes in frames [first,first+nbits) of 'stack',
+// thresholded against the mean of the sinusoidal patterns in frames
+// [middle,middle+nphases), in rows [y0,y1).
+// 'threshold' is relative to the maximum of each frame and applies to the
+// difference from the mean, as in AccumulateGrayCodeLevel(), or to the
+// level of each tile of 'levels'.
+inline 
+void DecodeGrayCodeStack(const CFrameStack &stack, const int first, const int nbits, const int middle, const int nphases, const float threshold, Field<2,float>& result, Field<2,int>& uncertainty, const int y0, const int y1, const int xor_base = -1, const CTileHistogram *levels = 0)
+{
+	const unsigned int high = xor_base < 0 ? 0 : GetXorMask(xor_base, nbits);
+	std::vector<float> thresholds(nbits);
+	for (int b = 0; b < nbits; b++)
+		thresholds[b] = threshold * stack.GetMax(first + b);
+	const float scale = 1.0f / nphases;
+
+	std::vector<float> tiled(nbits);
+
+	const int w = stack.size(0);
+	const int B = CFrameStack::BLOCK;
+	for (int y = y0; y < y1; y++) {
+		float *dst = result.ptr() + y * w;
+		int *u = uncertainty.ptr() + y * w;
+		for (int x = 0; x < w; x += B) {
+			const unsigned short *p = stack.block(x, y) + first * B;
+			const float *th = &thresholds[0];
+			if (levels) {
+				std::fill(tiled.begin(), tiled.end(), threshold * 65535 * levels->GetLevel(x, y));
+				th = &tiled[0];
+			}
+			const unsigned short *q = stack.block(x, y) + middle * B;
+			int i = 0;
+#if defined(SLIB_SIMD_SSE2)
+			for (; i + simd::width <= B && x + i + simd::width <= w; i += simd::width) {
+				simd::vfloat m = simd::zero();
+				for (int r = 0; r < nphases; r++)
+					m = simd::add(m, simd::load_u16(q + r * B + i));
+				m = simd::mul(m, simd::set1(scale));
+				simd::vint c = simd::set1i(0), n = simd::set1i(0);
+				for (int b = 0; b < nbits; b++) {
+					simd::vfloat d = simd::sub(simd::load_u16(p + b * B + i), m);
+					simd::vfloat gt = simd::cmpgt(d, simd::zero());
+					c = simd::ori(c, simd::andi(simd::as_int(gt), simd::set1i(1 << (nbits - 1 - b))));
+					n = simd::subi(n, simd::as_int(simd::cmplt(simd::abs(d), simd::set1(th[b]))));
+				}
+				if (high)
+					c = ConvertXorToGray(c, xor_base, high);
+				unsigned int code[simd::width];
+				simd::storei(code, c);
+				simd::storei(u + x + i, n);
+				ConvertGrayToBinary(code, dst + x + i, simd::width);
+			}
+#endif
+			for (; i < B && x + i < w; i++) {
+				float m = 0;
+				for (int r = 0; r < nphases; r++)
+					m += q[r * B + i];
+				m *= scale;
+				unsigned int code = 0;
+				int count = 0;
+				for (int b = 0; b < nbits; b++) {
+					float d = p[b * B + i] - m;
+					code |= (d > 0) << (nbits - 1 - b);
+					count += std::abs(d) < th[b];
+				}
+				if (high)
+					code = ConvertXorToGray(code, xor_base, high);
+				dst[x + i] = ConvertGrayToBinary(code);
+				u[x + i] = count;
+			}
+		}
+	}
+}
+
 //------------------------------------------------------------
 // phase-shifting code
 //------------------------------------------------------------
 
-// generate moire pattern images.
+namespace {
+// atan2 by a minimax polynomial of atan on [0,1] and octant reduction.
+// absolute error is below 2e-6 rad.
+inline
+float FastAtan2(const float y, const float x)
+{
+	float ax = std::abs(x), ay = std::abs(y);
+	float a = std::min(ax, ay) / std::max(ax, ay);
+	float s = a * a;
+	float r = (((((-0.01172120f * s + 0.05265332f) * s - 0.11643287f) * s + 0.19354346f) * s - 0.33262347f) * s + 0.99997726f) * a;
+	if (ay > ax)
+		r = 1.57079637f - r;
+	if (x < 0)
+		r = 3.14159274f - r;
+	if (y < 0)
+		r = -r;
+	return r;
+}
+
+// phase in [0,1) and modulation amplitude from the cos/sin terms 'c' and 's'.
+// phase is NaN where the amplitude vanishes.
+inline
+void ConvertToPhase(const float c, const float s, const float scale, float& phase, float& amplitude)
+{
+	amplitude = scale * sqrt(c * c + s * s);
+	phase = FastAtan2(c, s) * (float)(0.5 / M_PI);
+	if (phase < 0)
+		phase += 1;
+	if (amplitude == 0)
+		phase = std::numeric_limits<float>::quiet_NaN();
+}
+
+#if defined(SLIB_SIMD_SSE2)
+inline
+simd::vfloat FastAtan2(const simd::vfloat y, const simd::vfloat x)
+{
+	using namespace simd;
+	vfloat ax = simd::abs(x), ay = simd::abs(y);
+	vfloat a = div(simd::min(ax, ay), simd::max(ax, ay));
+	vfloat s = mul(a, a);
+	vfloat r = set1(-0.01172120f);
+	r = add(mul(r, s), set1(0.05265332f));
+	r = add(mul(r, s), set1(-0.11643287f));
+	r = add(mul(r, s), set1(0.19354346f));
+	r = add(mul(r, s), set1(-0.33262347f));
+	r = mul(add(mul(r, s), set1(0.99997726f)), a);
+	r = select(cmpgt(ay, ax), sub(set1(1.57079637f), r), r);
+	r = select(cmplt(x, zero()), sub(set1(3.14159274f), r), r);
+	return bit_xor(r, bit_and(y, set1(-0.0f)));
+}
+
+inline
+void ConvertToPhase(const simd::vfloat c, const simd::vfloat s, const simd::vfloat scale, simd::vfloat& phase, simd::vfloat& amplitude)
+{
+	using namespace simd;
+	amplitude = mul(scale, simd::sqrt(add(mul(c, c), mul(s, s))));
+	phase = mul(FastAtan2(c, s), set1((float)(0.5 / M_PI)));
+	phase = select(cmplt(phase, zero()), add(phase, set1(1.0f)), phase);
+	phase = select(cmpeq(amplitude, zero()), set1(std::numeric_limits<float>::quiet_NaN()), phase);
+}
+#endif
+
+// cos and sin of the 'index'-th of 'nphases' equal shifts.
+// exactly zero at multiples of pi/2 so that those terms can be skipped.
+inline
+void GetPhaseShift(const int index, const int nphases, float& c, float& s)
+{
+	double t = 2 * M_PI * index / nphases;
+	c = std::abs(cos(t)) < 1e-6 ? 0.0f : (float)cos(t);
+	s = std::abs(sin(t)) < 1e-6 ? 0.0f : (float)sin(t);
+}
+
+// least-squares cos/sin terms of 'nphases' equally shifted images.
+// for N >= 3 the pseudo-inverse is 2/N times the cos/sin columns of the
+// design matrix, so N-step shifts keep the coefficients in a fixed table 
+// and the loop over the images is unrolled.
+template <int nphases>
+struct PhaseShiftTerms
+{
+	float pc[nphases], ps[nphases];
+
+	PhaseShiftTerms()
+	{
+		for (int r = 0; r < nphases; r++)
+		{
+			GetPhaseShift(r, nphases, pc[r], ps[r]);
+			pc[r] *= 2.0f / nphases;
+			ps[r] *= 2.0f / nphases;
+		}
+	}
+
+	void operator()(const float *const *rows, const int x, float& c, float& s) const
+	{
+		c = s = 0;
+		for (int r = 0; r < nphases; r++)
+		{
+			c += pc[r] * rows[r][x];
+			s += ps[r] * rows[r][x];
+		}
+	}
+
+#if defined(SLIB_SIMD_SSE2)
+	void operator()(const float *const *rows, const int x, simd::vfloat& c, simd::vfloat& s) const
+	{
+		c = s = simd::zero();
+		for (int r = 0; r < nphases; r++)
+		{
+			simd::vfloat v = simd::load(rows[r] + x);
+			c = simd::add(c, simd::mul(simd::set1(pc[r]), v));
+			s = simd::add(s, simd::mul(simd::set1(ps[r]), v));
+		}
+	}
+#endif
+};
+
+// 3-step: c = (2*I0 - I1 - I2) / 3, s = (I1 - I2) / sqrt(3)
+template <>
+struct PhaseShiftTerms<3>
+{
+	void operator()(const float *const *rows, const int x, float& c, float& s) const
+	{
+		c = (2 * rows[0][x] - rows[1][x] - rows[2][x]) * (1.0f / 3);
+		s = (rows[1][x] - rows[2][x]) * 0.577350269f;
+	}
+
+#if defined(SLIB_SIMD_SSE2)
+	void operator()(const float *const *rows, const int x, simd::vfloat& c, simd::vfloat& s) const
+	{
+		simd::vfloat i0 = simd::load(rows[0] + x), i1 = simd::load(rows[1] + x), i2 = simd::load(rows[2] + x);
+		c = simd::mul(simd::sub(simd::add(i0, i0), simd::add(i1, i2)), simd::set1(1.0f / 3));
+		s = simd::mul(simd::sub(i1, i2), simd::set1(0.577350269f));
+	}
+#endif
+};
+
+// 4-step: c = (I0 - I2) / 2, s = (I1 - I3) / 2
+template <>
+struct PhaseShiftTerms<4>
+{
+	void operator()(const float *const *rows, const int x, float& c, float& s) const
+	{
+		c = (rows[0][x] - rows[2][x]) * 0.5f;
+		s = (rows[1][x] - rows[3][x]) * 0.5f;
+	}
+
+#if defined(SLIB_SIMD_SSE2)
+	void operator()(const float *const *rows, const int x, simd::vfloat& c, simd::vfloat& s) const
+	{
+		c = simd::mul(simd::sub(simd::load(rows[0] + x), simd::load(rows[2] + x)), simd::set1(0.5f));
+		s = simd::mul(simd::sub(simd::load(rows[1] + x), simd::load(rows[3] + x)), simd::set1(0.5f));
+	}
+#endif
+};
+
+// any number of images, with the pseudo-inverse computed at run time
+struct DynamicPhaseShiftTerms
+{
+	int nphases;
+	std::vector<float> pc, ps;
+
+	DynamicPhaseShiftTerms(const int n) : nphases(n), pc(n), ps(n)
+	{
+		CDynamicMatrix<float> mat(nphases, 3);
+		for (int r = 0; r < nphases; r++)
+		{
+			mat(r, 0) = cos(2 * M_PI * r / nphases);
+			mat(r, 1) = sin(2 * M_PI * r / nphases);
+			mat(r, 2) = 1;
+		}
+		mat = GetPseudoInverse(mat);
+
+		// cos and sin rows of the pseudo-inverse
+		for (int r = 0; r < nphases; r++)
+		{
+			pc[r] = mat(0, r);
+			ps[r] = mat(1, r);
+		}
+	}
+
+	void operator()(const float *const *rows, const int x, float& c, float& s) const
+	{
+		c = s = 0;
+		for (int r = 0; r < nphases; r++)
+		{
+			c += pc[r] * rows[r][x];
+			s += ps[r] * rows[r][x];
+		}
+	}
+
+#if defined(SLIB_SIMD_SSE2)
+	void operator()(const float *const *rows, const int x, simd::vfloat& c, simd::vfloat& s) const
+	{
+		c = s = simd::zero();
+		for (int r = 0; r < nphases; r++)
+		{
+			simd::vfloat v = simd::load(rows[r] + x);
+			c = simd::add(c, simd::mul(simd::set1(pc[r]), v));
+			s = simd::add(s, simd::mul(simd::set1(ps[r]), v));
+		}
+	}
+#endif
+};
+
+template <typename terms_t>
+inline
+void DecodePhaseCodeRows(const std::vector<Field<2,float> > &images, const terms_t& terms, Field<2,float>& result, Field<2,float>& amplitude)
+{
+	const CVector<2,int>& size = images[0].size();
+	const int nphases = images.size();
+	const int w = size[0];
+
+	result.Initialize(size);
+	amplitude.Initialize(size);
+	std::vector<const float *> rows(nphases);
+	for (int y = 0; y < size[1]; y++)
+	{
+		for (int r = 0; r < nphases; r++)
+			rows[r] = images[r].ptr() + y * w;
+		float *phase = result.ptr() + y * w;
+		float *amp = amplitude.ptr() + y * w;
+
+		int x = 0;
+#if defined(SLIB_SIMD_SSE2)
+		for (; x + simd::width <= w; x += simd::width)
+		{
+			simd::vfloat c, s, p, a;
+			terms(&rows[0], x, c, s);
+			ConvertToPhase(c, s, simd::set1(1.0f), p, a);
+			simd::store(phase + x, p);
+			simd::store(amp + x, a);
+		}
+#endif
+		for (; x < w; x++)
+		{
+			float c, s;
+			terms(&rows[0], x, c, s);
+			ConvertToPhase(c, s, 1.0f, phase[x], amp[x]);
+		}
+	}
+}
+
+// phase and amplitude of 'n' pixels of summed cos/sin terms
+inline
+void DecodePhaseCodeSums(const float *c, const float *s, const float scale, float *phase, float *amp, const int n)
+{
+	int i = 0;
+#if defined(SLIB_SIMD_SSE2)
+	for (; i + simd::width <= n; i += simd::width)
+	{
+		simd::vfloat p, a;
+		ConvertToPhase(simd::load(c + i), simd::load(s + i), simd::set1(scale), p, a);
+		simd::store(phase + i, p);
+		simd::store(amp + i, a);
+	}
+#endif
+	for (; i < n; i++)
+		ConvertToPhase(c[i], s[i], scale, phase[i], amp[i]);
+}
+
+// unwrap 'n' pixels; see UnwrapPhase()
+inline
+void UnwrapPhase(const float *phase, const int period, const float *reference, float *result, float *unwrap_error, const int n, const float tolerance = 2)
+{
+	// max correctable phase error
+	float window = tolerance/period;
+
+	for (int x = 0; x < n; x++) {
+		int graycode = reference[x];	// in [0,width)
+		float moire_phase = phase[x];	// in [0,1)
+		float gray_phase = (float)(graycode % period) / period;	// in [0,1)
+
+		if (moire_phase != moire_phase) { // isnan(moire_phase)
+			result[x] = graycode;
+			unwrap_error[x] = 0.5;
+			continue;
+		}
+
+		// normalized:  moire in [gray-0.5, gray+0.5)
+		//  0      -w        +w 1
+		// -|-------o====g====o-|----
+		// ----x=========m=========o-
+		if (moire_phase >= gray_phase + 0.5)
+			moire_phase -= 1;
+		else if (moire_phase < gray_phase - 0.5)
+			moire_phase += 1;
+
+		float diff = std::abs(gray_phase - moire_phase);
+		if (diff < window) {
+			result[x] = graycode - (graycode % period) + period * moire_phase;
+		} else {
+			result[x] = graycode;
+		}
+		unwrap_error[x] = diff;
+	}
+}
+
+// unwrap 'n' pixels and classify them in the same pass.
+// the phase is unwrapped in gray-code units, where the unwrapped code is
+// the gray code plus the offset of the phase from it, wrapped to half a
+// period, and all cases are selected with masks instead of branches.
+// the offset is applied where it is below 'tolerance' code units.
+// 'reliable' is 1 where it is applied and fewer than 2 gray bits were
+// uncertain; 'mask' is 1 where fewer than 'maxuncertain' bits were
+// uncertain.
+inline
+void UnwrapPhase(const float *phase, const int period, const float *reference, const int *uncertainty, const int maxuncertain, const float tolerance, float *result, float *reliable, float *mask, const int n)
+{
+	const float p = (float)period, half = 0.5f * period, inv = 1.0f / period;
+	int x = 0;
+#if defined(SLIB_SIMD_SSE2)
+	using namespace simd;
+	const vfloat vp = set1(p), vhalf = set1(half), vnhalf = set1(-half), vone = set1(1.0f), vwindow = set1(2.0f);
+	const vfloat vtolerance = set1(tolerance);
+	for (; x + width <= n; x += width) {
+		vfloat code = load(reference + x);
+		vfloat moire = load(phase + x);
+
+		// code % period; the quotient may be off by one after rounding
+		vfloat r = sub(code, mul(vp, to_float(to_int(mul(code, set1(inv))))));
+		r = select(cmplt(r, vp), r, sub(r, vp));
+		r = select(cmplt(r, zero()), add(r, vp), r);
+
+		vfloat d = sub(mul(moire, vp), r);
+		d = select(cmplt(d, vhalf), d, sub(d, vp));
+		d = select(cmplt(d, vnhalf), add(d, vp), d);
+
+		// false for NaN phase
+		vfloat ok = cmplt(simd::abs(d), vtolerance);
+		store(result + x, add(code, bit_and(ok, d)));
+
+		vfloat e = to_float(loadi(uncertainty + x));
+		store(reliable + x, bit_and(bit_and(ok, cmplt(e, vwindow)), vone));
+		store(mask + x, bit_and(cmplt(e, set1((float)maxuncertain)), vone));
+	}
+#endif
+	for (; x < n; x++) {
+		float code = reference[x];
+		float r = code - p * (int)(code * inv);
+		r = r < p ? r : r - p;
+		r = r < 0 ? r + p : r;
+
+		float d = phase[x] * p - r;
+		d = d < half ? d : d - p;
+		d = d < -half ? d + p : d;
+
+		bool ok = std::abs(d) < tolerance;
+		result[x] = ok ? code + d : code;
+		reliable[x] = ok && uncertainty[x] < 2;
+		mask[x] = uncertainty[x] < maxuncertain;
+	}
+}
+
+// fractional part in [0,1)
+inline
+float GetFraction(const float a)
+{
+	return a - floor(a);
+}
+
+// phase in cycles by which the coarser of three heterodyne fringes of
+// 'periods[k]' pixels may disagree with a code: a sixth of the least
+// that any other multiple of the finest period within the 'span' of
+// their beat disagrees with them, so that a wrong code takes five times
+// the phase noise a right one is allowed
+inline
+float GetHeterodyneTolerance(const float *periods, const float span)
+{
+	const int n = (int)(span / periods[0] + 0.5f);
+	float least = 0.5f;
+	for (int m = 1; m < n; m++) {
+		float e = 0;
+		for (int k = 1; k < 3; k++) {
+			float q = m * periods[0] / periods[k];
+			e = std::max(e, std::abs(q - (float)floor(q + 0.5f)));
+		}
+		least = std::min(least, e);
+	}
+	return least / 6;
+}
+
+// unwrap 'n' pixels of the wrapped phases 'phase[k]' of three fringes of
+// 'periods[k]' pixels, finest first, whose beat covers 'span' pixels.
+// the beat of all fringes is the absolute coordinate; it selects the
+// period of the beat of the two finest fringes, which in turn selects
+// the period of the finest fringe.
+// each step multiplies the phase noise by the ratio of the periods it
+// bridges, so its window is a quarter period where that ratio is the
+// largest and narrower in proportion where it is not. the code is then
+// checked against the phase of every fringe, within 'tolerance' cycles
+// of GetHeterodyneTolerance().
+// the beat repeats beyond the 'size' pixels of the projector, so codes
+// past the middle of the spare pixels are taken as left of pixel 0.
+// 'mask' is 1 where 'amplitude' reaches 'threshold', and 'reliable' is 1
+// where the pixel is masked, both steps and all phases agree and the code
+// is on the projector.
+inline
+void UnwrapHeterodyne(const float *const *phase, const float *periods, const float span, const float size, const float tolerance, const float *amplitude, const float threshold, float *result, float *reliable, float *mask, const int n)
+{
+	const float p0 = periods[0], inv0 = 1.0f / p0, inv1 = 1.0f / periods[1], inv2 = 1.0f / periods[2];
+	const float wrap = size + 0.5f * (span - size);
+	const float p01 = periods[0] * periods[1] / (periods[1] - periods[0]), inv01 = 1.0f / p01;
+
+	// the coarse coordinate sums three phases and the beat two
+	const float gain1 = sqrt(6.0f) * span / p01, gain0 = sqrt(2.0f) * p01 / p0;
+	const float window1 = 0.25f * gain1 / std::max(gain0, gain1), window0 = 0.25f * gain0 / std::max(gain0, gain1);
+	int x = 0;
+#if defined(SLIB_SIMD_SSE2)
+	{
+		using namespace simd;
+		const vfloat vspan = set1(span), vp0 = set1(p0), vinv0 = set1(inv0), vinv1 = set1(inv1), vinv2 = set1(inv2), vp01 = set1(p01), vinv01 = set1(inv01);
+		const vfloat half = set1(0.5f), one = set1(1.0f), vthreshold = set1(threshold);
+		const vfloat vwindow0 = set1(window0), vwindow1 = set1(window1), vtolerance = set1(tolerance);
+		const vfloat vsize = set1(size), vwrap = set1(wrap);
+		for (; x + width <= n; x += width) {
+			vfloat f0 = load(phase[0] + x), f1 = load(phase[1] + x), f2 = load(phase[2] + x);
+			vfloat b = sub(f0, f1);
+			b = sub(b, simd::floor(b));
+			vfloat c = sub(f1, f2);
+			c = sub(b, sub(c, simd::floor(c)));
+			vfloat coarse = mul(sub(c, simd::floor(c)), vspan);
+			vfloat t = sub(mul(coarse, vinv01), b);
+			vfloat k = simd::floor(add(t, half));
+			vfloat ok = cmplt(simd::abs(sub(t, k)), vwindow1);
+			coarse = mul(add(k, b), vp01);
+
+			t = sub(mul(coarse, vinv0), f0);
+			k = simd::floor(add(t, half));
+			ok = bit_and(ok, cmplt(simd::abs(sub(t, k)), vwindow0));
+			vfloat code = mul(add(k, f0), vp0);
+			code = sub(code, bit_and(cmpgt(code, vwrap), vspan));
+			ok = bit_and(ok, bit_andnot(cmplt(code, zero()), cmplt(code, vsize)));
+
+			vfloat r = sub(mul(code, vinv1), f1);
+			ok = bit_and(ok, cmplt(simd::abs(sub(r, simd::floor(add(r, half)))), vtolerance));
+			r = sub(mul(code, vinv2), f2);
+			ok = bit_and(ok, cmplt(simd::abs(sub(r, simd::floor(add(r, half)))), vtolerance));
+
+			vfloat m = bit_andnot(cmplt(load(amplitude + x), vthreshold), one);
+			store(result + x, bit_and(cmpeq(code, code), code));
+			store(reliable + x, bit_and(ok, m));
+			store(mask + x, m);
+		}
+	}
+#endif
+	for (; x < n; x++) {
+		const float f0 = phase[0][x], f1 = phase[1][x], f2 = phase[2][x];
+		float b = GetFraction(f0 - f1);
+		float coarse = GetFraction(b - GetFraction(f1 - f2)) * span;
+		float t = coarse * inv01 - b;
+		float k = floor(t + 0.5f);
+		bool ok = std::abs(t - k) < window1;
+		coarse = (k + b) * p01;
+
+		t = coarse * inv0 - f0;
+		k = floor(t + 0.5f);
+		ok = ok && std::abs(t - k) < window0;
+		float code = (k + f0) * p0;
+		code = code > wrap ? code - span : code;
+		ok = ok && code >= 0 && code < size;
+
+		float r1 = code * inv1 - f1, r2 = code * inv2 - f2;
+		ok = ok && std::abs(r1 - floor(r1 + 0.5f)) < tolerance && std::abs(r2 - floor(r2 + 0.5f)) < tolerance;
+		result[x] = code == code ? code : 0;
+		mask[x] = !(amplitude[x] < threshold);
+		reliable[x] = ok && mask[x];
+	}
+}
+} // unnamed namespace
+
+// sinusoidal pattern over 'size' pixels.
 // 'period' is the phase period of sinusoidal curve in pixel
+// 'phase' is the shift of the curve in pixel
 inline 
-void GeneratePhaseCodeImage(const int direction, const int period, const int phase, Field<2,unsigned char> &bmp)
+void GeneratePhaseCodeProfile(const int period, const int phase, const int size, std::vector<unsigned char> &profile)
 {
 	std::vector<unsigned char> table(period);
 	for (int i = 0; i < period; i++)
 		table[i] = (sin(2.0 * M_PI * (i + phase) / period) / 2.0 + 0.5) * 255;
 
-	if( direction == 0 ) {
-		for (int y = 0; y < bmp.size(1); y++)
-			for (int x = 0; x < bmp.size(0); x++)
-				bmp.cell(x, y) = table[x % period];
-	} else {
-		for (int y = 0; y < bmp.size(1); y++)
-			for (int x = 0; x < bmp.size(0); x++)
-				bmp.cell(x, y) = table[y % period];
-	}
+	profile.resize(size);
+	for (int i = 0; i < size; i++)
+		profile[i] = table[i % period];
+}
+
+// generate moire pattern images.
+// 'period' is the phase period of sinusoidal curve in pixel
+// 'phase' is the shift of the curve in pixel
+inline 
+void GeneratePhaseCodeImage(const int direction, const int period, const int phase, Field<2,unsigned char> &bmp)
+{
+	std::vector<unsigned char> profile;
+	GeneratePhaseCodeProfile(period, phase, bmp.size(direction), profile);
+	ExpandProfile(direction, &profile[0], bmp);
+}
+
+// sinusoidal pattern of a fractional 'period' in pixel over 'size'
+// pixels, shifted by 'shift' periods
+inline 
+void GenerateFringeProfile(const double period, const double shift, const int size, std::vector<unsigned char> &profile)
+{
+	profile.resize(size);
+	for (int i = 0; i < size; i++)
+		profile[i] = (sin(2.0 * M_PI * (i / period + shift)) / 2.0 + 0.5) * 255;
+}
+
+// generate a sinusoidal pattern of a fractional 'period' in pixel, shifted
+// by 'shift' periods, as GeneratePhaseCodeImage() does for integer periods
+inline 
+void GenerateFringeImage(const int direction, const double period, const double shift, Field<2,unsigned char> &bmp)
+{
+	std::vector<unsigned char> profile;
+	GenerateFringeProfile(period, shift, bmp.size(direction), profile);
+	ExpandProfile(direction, &profile[0], bmp);
 }
 
 // generate phase image from moire pattern images.
+// 'amplitude' receives the modulation amplitude, which serves as a quality map.
+// 3- and 4-step shifts use the closed-form arctangent formulas.
+inline 
+void DecodePhaseCodeImages(const std::vector<Field<2,float> > &images, Field<2,float>& result, Field<2,float>& amplitude)
+{
+	switch (images.size())
+	{
+	case 3: DecodePhaseCodeRows(images, PhaseShiftTerms<3>(), result, amplitude); break;
+	case 4: DecodePhaseCodeRows(images, PhaseShiftTerms<4>(), result, amplitude); break;
+	case 5: DecodePhaseCodeRows(images, PhaseShiftTerms<5>(), result, amplitude); break;
+	case 6: DecodePhaseCodeRows(images, PhaseShiftTerms<6>(), result, amplitude); break;
+	case 8: DecodePhaseCodeRows(images, PhaseShiftTerms<8>(), result, amplitude); break;
+	default: DecodePhaseCodeRows(images, DynamicPhaseShiftTerms(images.size()), result, amplitude); break;
+	}
+}
+
 inline 
 void DecodePhaseCodeImages(const std::vector<Field<2,float> > &images, Field<2,float>& result)
 {
-	const CVector<2,int>& size = images[0].size();
-	const int nphases = images.size();
+	Field<2,float> amplitude;
+	DecodePhaseCodeImages(images, result, amplitude);
+}
 
-	CDynamicMatrix<float> mat(nphases, 3);
-	for (int r = 0; r < nphases; r++)
-	{
-		mat(r, 0) = cos(2 * M_PI * r / nphases);
-		mat(r, 1) = sin(2 * M_PI * r / nphases);
-		mat(r, 2) = 1;
+// accumulate rows [y0,y1) of the 'index'-th of 'nphases' moire pattern 
+// images into the normal equation of DecodePhaseCodeImages().
+// the pseudo-inverse of equally shifted sinusoids is diagonal, so the
+// cos/sin terms can be summed as the images arrive.
+// the sums must be initialized and cleared before the first image.
+// 'image' may be a float image or a CFrameView.
+template <typename image_t> inline 
+void AccumulatePhaseCodeImage(const image_t &image, const int index, const int nphases, Field<2,float>& sum_cos, Field<2,float>& sum_sin, const int y0, const int y1)
+{
+	float c, s;
+	GetPhaseShift(index, nphases, c, s);
+	const int w = image.size(0);
+	std::vector<float> buffer(w);
+	for (int y = y0; y < y1; y++) {
+		const float *src = GetRow(image, y, &buffer[0]);
+		float *dc = sum_cos.ptr() + y * w, *ds = sum_sin.ptr() + y * w;
+		if (c != 0)
+			for (int x = 0; x < w; x++)
+				dc[x] += c * src[x];
+		if (s != 0)
+			for (int x = 0; x < w; x++)
+				ds[x] += s * src[x];
 	}
-	mat = GetPseudoInverse(mat);
+}
 
-	result.Initialize(size);
-	for (int y = 0; y < size[1]; y++)
-	{
-		for (int x = 0; x < size[0]; x++)
-		{
-			CDynamicVector<float> vec(nphases);
-			for (int r = 0; r < nphases; r++)
-				vec[r] = images[r].cell(x, y);
-			vec = mat * vec;
-			float A = sqrt(vec[0] * vec[0] + vec[1] * vec[1]);
-			float phi = atan2(vec[0] / A, vec[1] / A);
-			float m = vec[2];
-			while (phi < 0)
-				phi += 2 * M_PI;
-			result.cell(x, y) = phi / (2 * M_PI);
+// accumulate the pixels of 'spans' in rows [y0,y1)
+template <typename image_t> inline 
+void AccumulatePhaseCodeImage(const image_t &image, const int index, const int nphases, Field<2,float>& sum_cos, Field<2,float>& sum_sin, const CRowSpans& spans, const int y0, const int y1)
+{
+	float c, s;
+	GetPhaseShift(index, nphases, c, s);
+	const int w = image.size(0);
+	std::vector<float> buffer(w);
+	for (int y = y0; y < y1; y++) {
+		const CRowSpans::row_t& r = spans.row(y);
+		for (size_t i = 0; i < r.size(); i++) {
+			const float *src = GetRow(image, y, r[i].x0, r[i].x1, &buffer[0]);
+			float *dc = sum_cos.ptr() + y * w, *ds = sum_sin.ptr() + y * w;
+			if (c != 0)
+				for (int x = r[i].x0; x < r[i].x1; x++)
+					dc[x] += c * src[x];
+			if (s != 0)
+				for (int x = r[i].x0; x < r[i].x1; x++)
+					ds[x] += s * src[x];
+		}
+	}
+}
+
+// also accumulate the DC term, the mean of the images, into 'sum_dc'
+template <typename image_t> inline 
+void AccumulatePhaseCodeImage(const image_t &image, const int index, const int nphases, Field<2,float>& sum_cos, Field<2,float>& sum_sin, Field<2,float>& sum_dc, const CRowSpans& spans, const int y0, const int y1)
+{
+	float c, s;
+	GetPhaseShift(index, nphases, c, s);
+	const float a = 1.0f / nphases;
+	const int w = image.size(0);
+	std::vector<float> buffer(w);
+	for (int y = y0; y < y1; y++) {
+		const CRowSpans::row_t& r = spans.row(y);
+		for (size_t i = 0; i < r.size(); i++) {
+			const float *src = GetRow(image, y, r[i].x0, r[i].x1, &buffer[0]);
+			float *dc = sum_cos.ptr() + y * w, *ds = sum_sin.ptr() + y * w, *dd = sum_dc.ptr() + y * w;
+			for (int x = r[i].x0; x < r[i].x1; x++) {
+				dc[x] += c * src[x];
+				ds[x] += s * src[x];
+				dd[x] += a * src[x];
+			}
+		}
+	}
+}
+
+template <typename image_t> inline 
+void AccumulatePhaseCodeImage(const image_t &image, const int index, const int nphases, Field<2,float>& sum_cos, Field<2,float>& sum_sin)
+{
+	if (index == 0) {
+		sum_cos.Initialize(image.size());
+		sum_cos.Clear(0);
+		sum_sin.Initialize(image.size());
+		sum_sin.Clear(0);
+	}
+	AccumulatePhaseCodeImage(image, index, nphases, sum_cos, sum_sin, 0, image.size(1));
+}
+
+// generate phase image and modulation amplitude in rows [y0,y1) from the 
+// sums of AccumulatePhaseCodeImage().
+// 'result' and 'amplitude' must be initialized to the size of the sums.
+inline 
+void DecodePhaseCodeSums(const Field<2,float>& sum_cos, const Field<2,float>& sum_sin, const int nphases, Field<2,float>& result, Field<2,float>& amplitude, const int y0, const int y1)
+{
+	const int w = sum_cos.size(0);
+	const int offset = y0 * w;
+	DecodePhaseCodeSums(sum_cos.ptr() + offset, sum_sin.ptr() + offset, 2.0f / nphases, result.ptr() + offset, amplitude.ptr() + offset, (y1 - y0) * w);
+}
+
+// decode the pixels of 'spans' in rows [y0,y1)
+inline 
+void DecodePhaseCodeSums(const Field<2,float>& sum_cos, const Field<2,float>& sum_sin, const int nphases, Field<2,float>& result, Field<2,float>& amplitude, const CRowSpans& spans, const int y0, const int y1)
+{
+	const int w = sum_cos.size(0);
+	for (int y = y0; y < y1; y++) {
+		const CRowSpans::row_t& r = spans.row(y);
+		for (size_t i = 0; i < r.size(); i++) {
+			const int offset = y * w + r[i].x0;
+			DecodePhaseCodeSums(sum_cos.ptr() + offset, sum_sin.ptr() + offset, 2.0f / nphases, result.ptr() + offset, amplitude.ptr() + offset, r[i].x1 - r[i].x0);
+		}
+	}
+}
+
+inline 
+void DecodePhaseCodeSums(const Field<2,float>& sum_cos, const Field<2,float>& sum_sin, const int nphases, Field<2,float>& result, Field<2,float>& amplitude)
+{
+	result.Initialize(sum_cos.size());
+	amplitude.Initialize(sum_cos.size());
+	DecodePhaseCodeSums(sum_cos, sum_sin, nphases, result, amplitude, 0, sum_cos.size(1));
+}
+
+// generate phase image and modulation amplitude in rows [y0,y1) from 
+// frames [first,first+nphases) of 'stack'.
+// 'result' and 'amplitude' must be initialized to the size of 'stack'.
+inline 
+void DecodePhaseCodeStack(const CFrameStack &stack, const int first, const int nphases, Field<2,float>& result, Field<2,float>& amplitude, const int y0, const int y1)
+{
+	std::vector<float> pc(nphases), ps(nphases);
+	for (int i = 0; i < nphases; i++)
+		GetPhaseShift(i, nphases, pc[i], ps[i]);
+	const float scale = 2.0f / nphases / 65535;
+
+	const int w = stack.size(0);
+	const int B = CFrameStack::BLOCK;
+	for (int y = y0; y < y1; y++) {
+		float *phase = result.ptr() + y * w, *amp = amplitude.ptr() + y * w;
+		for (int x = 0; x < w; x += B) {
+			const unsigned short *p = stack.block(x, y) + first * B;
+			int i = 0;
+#if defined(SLIB_SIMD_SSE2)
+			for (; i + simd::width <= B && x + i + simd::width <= w; i += simd::width) {
+				simd::vfloat c = simd::zero(), s = simd::zero(), vp, va;
+				for (int k = 0; k < nphases; k++) {
+					simd::vfloat v = simd::load_u16(p + k * B + i);
+					c = simd::add(c, simd::mul(simd::set1(pc[k]), v));
+					s = simd::add(s, simd::mul(simd::set1(ps[k]), v));
+				}
+				ConvertToPhase(c, s, simd::set1(scale), vp, va);
+				simd::store(phase + x + i, vp);
+				simd::store(amp + x + i, va);
+			}
+#endif
+			for (; i < B && x + i < w; i++) {
+				float c = 0, s = 0;
+				for (int k = 0; k < nphases; k++) {
+					c += pc[k] * p[k * B + i];
+					s += ps[k] * p[k * B + i];
+				}
+				ConvertToPhase(c, s, scale, phase[x + i], amp[x + i]);
+			}
 		}
 	}
 }
@@ -167,49 +1348,128 @@ void DecodePhaseCodeImages(const std::vector<Field<2,float> > &images, Field<2,f
 // phase unwrapping
 //------------------------------------------------------------
 
-// unwrap phase 
+// unwrap phase in rows [y0,y1)
 // 'period' is phase period of sinusoidal curve in pixel
 // 'reference' is reference integer code
 // 'tolerance' is max correctable error in reference global code (must be less than half of period)
+// 'result' and 'unwrap_error' must be initialized to the size of 'phase'.
 inline 
-void UnwrapPhase(const Field<2,float> &phase, const int period, const Field<2,float> &reference, Field<2,float>& result, Field<2,float>& unwrap_error)
+void UnwrapPhase(const Field<2,float> &phase, const int period, const Field<2,float> &reference, Field<2,float>& result, Field<2,float>& unwrap_error, const int y0, const int y1)
 {
-	// max correctable phase error
-	float window = 2.0/period;
+	const int w = phase.size(0);
+	const int offset = y0 * w;
+	UnwrapPhase(phase.ptr() + offset, period, reference.ptr() + offset, result.ptr() + offset, unwrap_error.ptr() + offset, (y1 - y0) * w);
+}
+
+// unwrap the pixels of 'spans' in rows [y0,y1)
+inline 
+void UnwrapPhase(const Field<2,float> &phase, const int period, const Field<2,float> &reference, Field<2,float>& result, Field<2,float>& unwrap_error, const CRowSpans& spans, const int y0, const int y1, const float tolerance = 2)
+{
+	const int w = phase.size(0);
+	for (int y = y0; y < y1; y++) {
+		const CRowSpans::row_t& r = spans.row(y);
+		for (size_t i = 0; i < r.size(); i++) {
+			const int offset = y * w + r[i].x0;
+			UnwrapPhase(phase.ptr() + offset, period, reference.ptr() + offset, result.ptr() + offset, unwrap_error.ptr() + offset, r[i].x1 - r[i].x0, tolerance);
+		}
+	}
+}
 
+// unwrap the pixels of 'spans' in rows [y0,y1), and write the reliable map
+// and the mask in the same pass instead of the unwrapping error.
+// see the pointer version for the criteria.
+inline 
+void UnwrapPhase(const Field<2,float> &phase, const int period, const Field<2,float> &reference, const Field<2,int> &uncertainty, const int maxuncertain, const float tolerance, Field<2,float>& result, Field<2,float>& reliable, Field<2,float>& mask, const CRowSpans& spans, const int y0, const int y1)
+{
+	const int w = phase.size(0);
+	for (int y = y0; y < y1; y++) {
+		const CRowSpans::row_t& r = spans.row(y);
+		for (size_t i = 0; i < r.size(); i++) {
+			const int offset = y * w + r[i].x0;
+			UnwrapPhase(phase.ptr() + offset, period, reference.ptr() + offset, uncertainty.ptr() + offset, maxuncertain, tolerance, result.ptr() + offset, reliable.ptr() + offset, mask.ptr() + offset, r[i].x1 - r[i].x0);
+		}
+	}
+}
+
+inline 
+void UnwrapPhase(const Field<2,float> &phase, const int period, const Field<2,float> &reference, Field<2,float>& result, Field<2,float>& unwrap_error)
+{
 	result.Initialize(phase.size());
 	unwrap_error.Initialize(phase.size());
+	UnwrapPhase(phase, period, reference, result, unwrap_error, 0, phase.size(1));
+}
+
+// unwrap the wrapped phases 'phase[k]' of three heterodyne fringes of
+// 'periods[k]' pixels and mask them by 'amplitude' in the pixels of
+// 'spans' in rows [y0,y1). see the pointer version for the arguments.
+inline 
+void UnwrapHeterodyne(const Field<2,float> *phase, const float *periods, const float span, const float size, const Field<2,float>& amplitude, const float threshold, Field<2,float>& result, Field<2,float>& reliable, Field<2,float>& mask, const CRowSpans& spans, const int y0, const int y1)
+{
+	const int w = result.size(0);
+	const float tolerance = GetHeterodyneTolerance(periods, span);
+	for (int y = y0; y < y1; y++) {
+		const CRowSpans::row_t& r = spans.row(y);
+		for (size_t i = 0; i < r.size(); i++) {
+			const int offset = y * w + r[i].x0;
+			const float *rows[3];
+			for (int k = 0; k < 3; k++)
+				rows[k] = phase[k].ptr() + offset;
+			UnwrapHeterodyne(rows, periods, span, size, tolerance, amplitude.ptr() + offset, threshold,
+				result.ptr() + offset, reliable.ptr() + offset, mask.ptr() + offset, r[i].x1 - r[i].x0);
+		}
+	}
+}
 
-	for (int y = 0; y < phase.size(1); y++) {
-		for (int x = 0; x < phase.size(0); x++) {
-			int graycode = reference.cell(x, y);	// in [0,width)
-			float moire_phase = phase.cell(x, y);	// in [0,1)
-			float gray_phase = (float)(graycode % period) / period;	// in [0,1)
+// gray code decoded from the planes of level 'skip' and up into the reference
+// of UnwrapPhase(), in the pixels of 'spans' in rows [y0,y1): the coarse
+// code is scaled back to pixels and centered in the 2^skip pixels that the
+// left-out planes would have told apart.
+inline 
+void ExpandGrayCode(Field<2,float>& code, const int skip, const CRowSpans& spans, const int y0, const int y1)
+{
+	const float scale = (float)(1 << skip), offset = 0.5f * (scale - 1);
+	const int w = code.size(0);
+	for (int y = y0; y < y1; y++) {
+		const CRowSpans::row_t& r = spans.row(y);
+		for (size_t i = 0; i < r.size(); i++) {
+			float *c = code.ptr() + y * w;
+			for (int x = r[i].x0; x < r[i].x1; x++)
+				c[x] = c[x] * scale + offset;
+		}
+	}
+}
 
-			if (moire_phase != moire_phase) { // isnan(moire_phase)
-				result.cell(x, y) = graycode;
-				unwrap_error.cell(x,y) = 0.5;
+// projector pixels per camera pixel along the steepest slope of the
+// coordinate map 'code': the median over every 'step'-th row and column
+// where 'mask' is set at the pixel and at the pixels 'step' to the right
+// and below, or 0 if there is none.
+// with 'period' > 0 the coordinates are only known modulo 'period'
+// pixels, as the wrapped phase of a quick probe scaled by the period, and
+// neighbouring pixels are compared instead, their difference wrapped to
+// half a period.
+inline 
+float EstimateFootprint(const Field<2,float>& code, const Field<2,float>& mask, const float period = 0, const int step = 4)
+{
+	const int d = period > 0 ? 1 : step;
+	std::vector<float> slopes;
+	for (int y = 0; y + d < code.size(1); y += step)
+		for (int x = 0; x + d < code.size(0); x += step) {
+			if (!mask.cell(x,y) || !mask.cell(x+d,y) || !mask.cell(x,y+d))
 				continue;
+			float dx = code.cell(x+d,y) - code.cell(x,y);
+			float dy = code.cell(x,y+d) - code.cell(x,y);
+			if (period > 0) {
+				dx -= period * floor(dx / period + 0.5f);
+				dy -= period * floor(dy / period + 0.5f);
 			}
-
-			// normalized:  moire in [gray-0.5, gray+0.5)
-			//  0      -w        +w 1
-			// -|-------o====g====o-|----
-			// ----x=========m=========o-
-			if (moire_phase >= gray_phase + 0.5)
-				moire_phase -= 1;
-			else if (moire_phase < gray_phase - 0.5)
-				moire_phase += 1;
-
-			float diff = std::abs(gray_phase - moire_phase);
-			if (diff < window) {
-				result.cell(x, y) = graycode - (graycode % period) + period * moire_phase;
-			} else {
-				result.cell(x, y) = graycode;
-			}
-			unwrap_error.cell(x,y) = diff;
+			float slope = sqrt(dx * dx + dy * dy) / d;
+			if (slope == slope)
+				slopes.push_back(slope);
 		}
-	}
+	if (slopes.empty())
+		return 0;
+	std::nth_element(slopes.begin(), slopes.begin() + slopes.size() / 2, slopes.end());
+	return slopes[slopes.size() / 2];
 }
 
 //------------------------------------------------------------
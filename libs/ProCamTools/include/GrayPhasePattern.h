@@ -0,0 +1,595 @@
+//
+// This file is part of ofxActiveScan.
+//
+// gray code followed by phase shifting, and its XOR-coded variant.
+// the gray code gives the integer coordinate and the phase its
+// sub-pixel part. with complementary pairs each bit takes two images;
+// otherwise the sinusoidal patterns are projected first and each bit is
+// thresholded against their DC term. the finest planes, which a camera
+// that sees several projector pixels per pixel cannot resolve, can be
+// left out (options_t::gray_skip); the phase then finds the coordinate
+// within the stripes of the finest plane projected.
+//
+
+#pragma once
+
+#include "Field.h"
+#include "FrameView.h"
+#include "FrameStack.h"
+#include "RowSpans.h"
+#include "ImageBmpIO.h"
+#include "ImageBase.h"
+
+#include "Options.h"
+#include "GrayCode.h"
+#include "PatternFamily.h"
+
+class CGrayPhasePattern : public CPatternFamily
+{
+public:
+	// 'xor_base' is the base level of XOR codes, or -1 for gray code
+	CGrayPhasePattern(const options_t& o, int xor_base = -1) : CPatternFamily(o), m_xor_base(xor_base) {}
+
+	const char *GetName(void) const {
+		return m_xor_base < 0 ? "graycode" : "xor";
+	}
+
+	int GetNumImages(int direction) const {
+		return get_num_gray_images(direction) + m_options.num_fringes;
+	}
+
+	// a gray-code bit takes about 6 operations, the conversion to binary
+	// 10, a phase image 4, the arctangent 25 and the unwrapping 20
+	int GetDecodeCost(int direction) const {
+		int n = m_options.get_num_gray_planes(direction);
+		return 6 * n + 10 + 4 * m_options.num_fringes + 45 + (m_xor_base < 0 ? 0 : 3);
+	}
+
+	// with complementary pairs the gray code comes first; otherwise the
+	// sinusoidal patterns come first, since their DC term is the threshold
+	// of the gray code
+	void GetProfile(int direction, int id, std::vector<unsigned char>& profile) const {
+		int ngray = get_num_gray_images(direction);
+		if (m_options.complementary) {
+			if (id < ngray)
+				get_gray(direction, id, profile);
+			else
+				get_phase(direction, id - ngray, profile);
+		} else {
+			if (id < m_options.num_fringes)
+				get_phase(direction, id, profile);
+			else
+				get_gray(direction, id - m_options.num_fringes, profile);
+		}
+	}
+
+	int GetStage(int direction, int count, int& done, int& total) const {
+		int ngray = get_num_gray_images(direction);
+		int nphases = m_options.num_fringes;
+		if (m_options.complementary ? count < ngray : count >= nphases) {
+			done = m_options.complementary ? count : count - nphases;
+			total = ngray;
+			return STAGE_CODE;
+		}
+		done = m_options.complementary ? count - ngray : count;
+		total = nphases;
+		return STAGE_PHASE;
+	}
+
+	CPatternDecoder *CreateDecoder(int direction) const;
+
+	int GetXorBase(void) const { return m_xor_base; }
+
+private:
+	// a pair per plane, or a single image per plane when thresholding
+	int get_num_gray_images(int direction) const {
+		return (m_options.complementary ? 2 : 1) * m_options.get_num_gray_planes(direction);
+	}
+
+	void get_gray(int direction, int id, std::vector<unsigned char>& profile) const {
+		int nbits = m_options.get_num_bits(direction);
+		int level = m_options.complementary ? nbits - 1 - id / 2 : nbits - 1 - id;
+		// id%2 == 1 if complementary
+		bool cmpl = m_options.complementary && id % 2;
+		if (m_xor_base < 0)
+			slib::GenerateGrayCodeProfile(level, GetProfileSize(direction), profile, cmpl);
+		else
+			slib::GenerateXorCodeProfile(level, std::max(m_xor_base, m_options.get_gray_skip(direction)), GetProfileSize(direction), profile, cmpl);
+	}
+
+	void get_phase(int direction, int id, std::vector<unsigned char>& profile) const {
+		slib::GeneratePhaseCodeProfile(m_options.get_fringe_period(), id * m_options.fringe_interval, GetProfileSize(direction), profile);
+	}
+
+private:
+	int m_xor_base;
+};
+
+class CGrayPhaseDecoder : public CPatternDecoder
+{
+public:
+	CGrayPhaseDecoder(const options_t& o, int direction, int xor_base)
+		: CPatternDecoder(o, direction), m_xor_base(xor_base) {}
+
+	void AddImage(int index, const slib::Field<2,float>& image) {
+		add(index, image);
+	}
+
+	void AddImage(int index, const slib::CFrameView& frame) {
+		add(index, frame);
+	}
+
+	bool CanDecodeStack(void) const {
+		return true;
+	}
+
+	void BeginStack(const slib::CFrameStack& stack, int first) {
+		const slib::CVector<2,int>& size = stack.size();
+		m_region.Initialize(size);
+		m_gray_map.Initialize(size);
+		m_gray_error.Initialize(size);
+		m_mask.Initialize(size);
+		initialize_phase(size);
+		if (m_options.adaptive_threshold) {
+			// the brighter frame of the first pair, or the brightest of the
+			// sinusoidal patterns
+			int n = m_options.complementary ? 2 : m_options.num_fringes;
+			build_levels(size, [&](int y, float *values) {
+				for (int x = 0; x < size[0]; x++) {
+					unsigned short m = 0;
+					for (int t = 0; t < n; t++)
+						m = std::max(m, stack.sample(x, y, first + t));
+					values[x] = m * (1.0f / 65535);
+				}
+			});
+		}
+	}
+
+	void DecodeStack(const slib::CFrameStack& stack, int first, int y0, int y1) {
+		int nbits = m_options.get_num_gray_planes(m_direction);
+		int nphases = m_options.num_fringes;
+		const slib::CTileHistogram *levels = m_options.adaptive_threshold ? &m_levels : 0;
+		if (m_options.complementary) {
+			DecodeGrayCodeStack(stack, first, nbits, m_options.intensity_threshold, m_gray_map, m_gray_error, y0, y1, get_xor_base(), levels);
+			DecodePhaseCodeStack(stack, first + 2 * nbits, nphases, m_map, m_amplitude, y0, y1);
+		} else {
+			DecodeGrayCodeStack(stack, first + nphases, nbits, first, nphases, 0.5f * m_options.intensity_threshold, m_gray_map, m_gray_error, y0, y1, get_xor_base(), levels);
+			DecodePhaseCodeStack(stack, first, nphases, m_map, m_amplitude, y0, y1);
+		}
+		expand_gray(y0, y1);
+		if (m_options.debug)
+			generate_mask(y0, y1);
+		unwrap_phase(y0, y1);
+	}
+
+	void EndStack(void) {
+		finish_phase();
+	}
+
+	// the first complementary pair, thresholded as in add_gray()
+	void MeasureQuality(const slib::CFrameStack& stack, int first) {
+		if (!m_options.complementary)
+			return;
+		slib::Field<2,float> image;
+		stack.GetFrame(first, m_pending);
+		stack.GetFrame(first + 1, image);
+		m_region.Initialize(stack.size());
+		float level;
+		if (m_options.adaptive_threshold) {
+			build_levels(stack.size(), [&](int y, float *values) {
+				const float *a = m_pending.ptr() + y * stack.size(0);
+				const float *b = image.ptr() + y * stack.size(0);
+				for (int x = 0; x < stack.size(0); x++)
+					values[x] = std::max(a[x], b[x]);
+			});
+			level = m_levels.GetLevel();
+		} else
+			level = std::max(stack.GetMax(first), stack.GetMax(first + 1)) * (1.0f / 65535);
+		measure_quality(image, m_options.intensity_threshold * level, level);
+		m_pending.Invalidate();
+	}
+
+private:
+	template <typename image_t>
+	void add(int index, const image_t& image)
+	{
+		if (index == 0)
+			m_region.Initialize(image.size());
+
+		int nphases = m_options.num_fringes;
+		if (!m_options.complementary) {
+			if (index < nphases)
+				add_phase(image, index);
+			else
+				add_level(image, index - nphases);
+		} else if (index < 2 * m_options.get_num_gray_planes(m_direction))
+			add_gray(image, index);
+		else
+			add_phase(image, index - 2 * m_options.get_num_gray_planes(m_direction));
+	}
+
+	template <typename image_t>
+	void add_gray(const image_t& image, int index)
+	{
+		const slib::CRowSpans& region = m_region;
+		if (index % 2 == 0) {
+			// frames are not owned, so the first image of a pair is copied.
+			// its maximum is taken while copying.
+			slib::Field<2,float>& pending = m_pending;
+			pending.Initialize(image.size());
+			m_pending_max = reduce_max(image.size(1), [&](int y0, int y1) {
+				return CopyImageRows(image, pending, region, y0, y1);
+			});
+			return;
+		}
+
+		int nbits = m_options.get_num_gray_planes(m_direction);
+		if (index == 1) {
+			m_gray_code.Initialize(image.size());
+			m_gray_code.Clear(0);
+			m_gray_error.Initialize(image.size());
+			m_gray_error.Clear(0);
+		}
+
+		// count error
+		int bit = index / 2;
+		float threshold, level;
+		if (m_options.adaptive_threshold) {
+			// the levels of the tiles from the brighter image of the first
+			// pair stand for the maximum of every pair
+			if (bit == 0) {
+				build_levels(image.size(), [&](int y, float *values) {
+					const float *a = m_pending.ptr() + y * image.size(0);
+					const float *b = GetRow(image, y, values);
+					for (int x = 0; x < image.size(0); x++)
+						values[x] = std::max(a[x], b[x]);
+				});
+			}
+			threshold = m_options.intensity_threshold;
+			m_pool->ParallelFor(0, image.size(1), [&](int y0, int y1) {
+				AccumulateGrayCodePair(m_pending, image, nbits-1-bit, threshold, m_levels, m_gray_code, m_gray_error, region, y0, y1);
+			});
+			level = m_levels.GetLevel();
+			threshold *= level;
+		} else {
+			float maxval = std::max(m_pending_max, reduce_max(image.size(1), [&](int y0, int y1) {
+				return GetImageMax(image, region, y0, y1);
+			}));
+			level = maxval;
+			threshold = m_options.intensity_threshold * maxval;
+			m_pool->ParallelFor(0, image.size(1), [&](int y0, int y1) {
+				AccumulateGrayCodePair(m_pending, image, nbits-1-bit, threshold, m_gray_code, m_gray_error, region, y0, y1);
+			});
+		}
+		if (bit == 0 && m_options.min_decodable > 0)
+			measure_quality(image, threshold, level);
+		if (bit == 0 && m_options.roi)
+			detect_region();
+
+		if (bit == nbits-1) {
+			decode_gray(image.size());
+			m_pending.Invalidate();
+		}
+	}
+
+	// histograms of the tiles of the intensities row(y, values) writes for
+	// each row, the rows of a tile on one thread, into the levels of the
+	// tiles: a high percentile, so that a few specular pixels are ignored,
+	// and at least half the level of the image, so that the tiles the
+	// patterns do not reach keep a threshold above the noise
+	template <typename function_t>
+	void build_levels(const slib::CVector<2,int>& size, function_t row)
+	{
+		m_levels.Initialize(size, LEVEL_TILE);
+		m_pool->ParallelFor(0, m_levels.GetNumTiles(1), [&](int t0, int t1) {
+			std::vector<float> values(size[0]);
+			for (int y = t0 * LEVEL_TILE; y < std::min(t1 * LEVEL_TILE, size[1]); y++) {
+				row(y, &values[0]);
+				m_levels.AddRow(y, 0, size[0], &values[0]);
+			}
+		});
+		m_levels.Finish(0.9f, 0.5f);
+	}
+
+	// contrast of the first pair where it decodes, and the fraction of the
+	// camera pixels where it does. the contrast is relative to 'level', the
+	// brightest intensity the threshold is a fraction of, so that it
+	// compares to intensity_threshold.
+	template <typename image_t>
+	void measure_quality(const image_t& image, float threshold, float level)
+	{
+		double sum = 0;
+		int count = 0;
+		std::mutex tile_mutex;
+		m_pool->ParallelFor(0, image.size(1), [&](int y0, int y1) {
+			int n;
+			double s = SumGrayCodeContrast(m_pending, image, threshold, n, m_region, y0, y1);
+			std::lock_guard<std::mutex> lock(tile_mutex);
+			sum += s;
+			count += n;
+		});
+		m_contrast = count && level > 0 ? (float)(sum / count / level) : 0.0f;
+		m_decodable = (float)count / ((double)image.size(0) * image.size(1));
+		m_quality = true;
+	}
+
+	// single gray-code images, thresholded against the DC term of the
+	// sinusoidal patterns that precede them
+	template <typename image_t>
+	void add_level(const image_t& image, int bit)
+	{
+		const slib::CRowSpans& region = m_region;
+		int nbits = m_options.get_num_gray_planes(m_direction);
+		if (bit == 0) {
+			m_gray_code.Initialize(image.size());
+			m_gray_code.Clear(0);
+			m_gray_error.Initialize(image.size());
+			m_gray_error.Clear(0);
+		}
+
+		// the distance to the middle level is half the difference of a
+		// complementary pair
+		if (m_options.adaptive_threshold) {
+			// the levels of the tiles from the peak of the sinusoidal
+			// patterns stand for the maximum of every image
+			if (bit == 0) {
+				build_levels(image.size(), [&](int y, float *values) {
+					const float *m = m_middle.ptr() + y * image.size(0);
+					const float *a = m_amplitude.ptr() + y * image.size(0);
+					for (int x = 0; x < image.size(0); x++)
+						values[x] = m[x] + a[x];
+				});
+			}
+			float threshold = 0.5f * m_options.intensity_threshold;
+			m_pool->ParallelFor(0, image.size(1), [&](int y0, int y1) {
+				AccumulateGrayCodeLevel(image, m_middle, nbits-1-bit, threshold, m_levels, m_gray_code, m_gray_error, region, y0, y1);
+			});
+		} else {
+			float maxval = reduce_max(image.size(1), [&](int y0, int y1) {
+				return GetImageMax(image, region, y0, y1);
+			});
+			float threshold = 0.5f * m_options.intensity_threshold * maxval;
+			m_pool->ParallelFor(0, image.size(1), [&](int y0, int y1) {
+				AccumulateGrayCodeLevel(image, m_middle, nbits-1-bit, threshold, m_gray_code, m_gray_error, region, y0, y1);
+			});
+		}
+		if (bit == 0 && m_options.roi)
+			detect_region();
+
+		if (bit == nbits-1) {
+			decode_gray(image.size());
+			m_middle.Invalidate();
+		}
+	}
+
+	// decode the gray code once all bits are folded.
+	// without complementary pairs the wrapped phase is already decoded and
+	// is unwrapped in the same pass.
+	void decode_gray(const slib::CVector<2,int>& size)
+	{
+		const slib::CRowSpans& region = m_region;
+		int nbits = m_options.get_num_gray_planes(m_direction);
+		m_gray_map.Initialize(size);
+		m_gray_map.Clear(0);
+		m_mask.Initialize(size);
+		m_mask.Clear(0);
+		m_pool->ParallelFor(0, size[1], [&](int y0, int y1) {
+			if (m_xor_base >= 0)
+				DecodeXorCode(m_gray_code, get_xor_base(), nbits, region, y0, y1);
+			DecodeGrayCode(m_gray_code, m_gray_map, region, y0, y1);
+			expand_gray(y0, y1);
+			if (m_options.debug)
+				generate_mask(y0, y1);
+			if (!m_options.complementary)
+				unwrap_phase(y0, y1);
+		});
+		m_gray_code.Invalidate();
+		if (!m_options.complementary)
+			finish_phase();
+	}
+
+	template <typename image_t>
+	void add_phase(const image_t& image, int index)
+	{
+		slib::Field<2,float> *sum = m_phase_sum;
+		if (index == 0) {
+			for (int i = 0; i < 2; i++) {
+				sum[i].Initialize(image.size());
+				sum[i].Clear(0);
+			}
+			if (!m_options.complementary) {
+				m_middle.Initialize(image.size());
+				m_middle.Clear(0);
+			}
+		}
+		m_pool->ParallelFor(0, image.size(1), [&](int y0, int y1) {
+			if (m_options.complementary)
+				AccumulatePhaseCodeImage(image, index, m_options.num_fringes, sum[0], sum[1], m_region, y0, y1);
+			else
+				AccumulatePhaseCodeImage(image, index, m_options.num_fringes, sum[0], sum[1], m_middle, m_region, y0, y1);
+		});
+
+		if (index == m_options.num_fringes-1) {
+			decode_phase();
+			sum[0].Invalidate();
+			sum[1].Invalidate();
+		}
+	}
+
+	// pixels where the first gray-code pair differs, with the stripe
+	// boundaries of the pair and a margin around the region included
+	void detect_region()
+	{
+		slib::CRowSpans& region = m_region;
+		const slib::Field<2,int>& error = m_gray_error;
+		m_pool->ParallelFor(0, region.size(1), [&](int y0, int y1) {
+			for (int y = y0; y < y1; y++) {
+				const int *e = error.ptr() + y * error.size(0);
+				region.SetRow(y, [e](int x) { return e[x] == 0; });
+			}
+		});
+		region.Grow(REGION_GAP, REGION_MARGIN);
+	}
+
+	void convert_reliable_map(int y0, int y1)
+	{
+		float maxerror = get_tolerance()/m_options.get_fringe_period();
+		slib::Field<2,float>& reliable = m_reliable;
+		for (int y=y0; y<y1; y++) {
+			const slib::CRowSpans::row_t& r = m_region.row(y);
+			for (size_t i=0; i<r.size(); i++) {
+				for (int x=r[i].x0; x<r[i].x1; x++) {
+					if (reliable.cell(x,y) < maxerror &&
+						m_gray_error.cell(x,y) < 2) {
+						reliable.cell(x,y) = 1;
+					} else {
+						reliable.cell(x,y) = 0;
+					}
+				}
+			}
+		}
+	}
+
+	// decode the phase from the sums, and unwrap it if the gray code is
+	// already decoded
+	void decode_phase()
+	{
+		const slib::Field<2,float> *sum = m_phase_sum;
+		const slib::CRowSpans& region = m_region;
+		bool unwrap = m_options.complementary;
+		initialize_phase(sum[0].size());
+		m_pool->ParallelFor(0, sum[0].size(1), [&](int y0, int y1) {
+			DecodePhaseCodeSums(sum[0], sum[1], m_options.num_fringes, m_map, m_amplitude, region, y0, y1);
+			if (unwrap)
+				unwrap_phase(y0, y1);
+		});
+		if (unwrap)
+			finish_phase();
+	}
+
+	void initialize_phase(const slib::CVector<2,int>& size)
+	{
+		m_map.Initialize(size);
+		m_map.Clear(0);
+		m_amplitude.Initialize(size);
+		m_amplitude.Clear(0);
+		m_reliable.Initialize(size);
+		m_reliable.Clear(0);
+	}
+
+	// unwrap rows [y0,y1) of the wrapped phase.
+	// the reliable map and the mask are written by the same pass, except
+	// in debug mode where the errors are dumped before being binarized.
+	void unwrap_phase(int y0, int y1)
+	{
+		if (m_options.debug)
+			UnwrapPhase(m_map, m_options.get_fringe_period(), m_gray_map, m_map, m_reliable, m_region, y0, y1, get_tolerance());
+		else
+			UnwrapPhase(m_map, m_options.get_fringe_period(), m_gray_map, m_gray_error, m_options.get_num_gray_planes(m_direction)-1,
+				get_tolerance(), m_map, m_reliable, m_mask, m_region, y0, y1);
+	}
+
+	// the gray code of the projected planes into pixels, centered in the
+	// stripes of the finest plane
+	void expand_gray(int y0, int y1)
+	{
+		int skip = m_options.get_gray_skip(m_direction);
+		if (skip)
+			ExpandGrayCode(m_gray_map, skip, m_region, y0, y1);
+	}
+
+	// max offset of the phase from the gray code, in pixels: 2, and half
+	// the stripes of the finest plane when planes are left out
+	float get_tolerance(void) const
+	{
+		return 2 + 0.5f * ((1 << m_options.get_gray_skip(m_direction)) - 1);
+	}
+
+	// base level of the XOR code within the projected planes
+	int get_xor_base(void) const
+	{
+		int skip = m_options.get_gray_skip(m_direction);
+		return m_xor_base < 0 ? -1 : std::max(m_xor_base, skip) - skip;
+	}
+
+	void finish_phase()
+	{
+		if (m_options.debug) {
+			dump_images();
+			m_pool->ParallelFor(0, m_reliable.size(1), [&](int y0, int y1) {
+				convert_reliable_map(y0, y1);
+			});
+		}
+	}
+
+	void dump_images() const
+	{
+		const char *suffix = get_suffix();
+		float s = 1.0/m_gray_map.size(0);
+		WriteCorrespondenceMap(m_gray_map, m_mask, slib::format("gray-%s.bmp", suffix), s);
+		WriteCorrespondenceMap(m_map, m_mask, slib::format("phase-%s.bmp", suffix), s);
+		ExportCorrespondencePlot(m_gray_map, m_mask, slib::format("gray-%s.dat", suffix));
+		ExportCorrespondencePlot(m_map, m_mask, slib::format("phase-%s.dat", suffix));
+
+		slib::Field<2,float> err;
+		slib::Field<2,slib::CVector<3,float> > rgb;
+
+		err=m_gray_error;
+		err /= m_options.get_num_gray_planes(m_direction);
+		slib::image::ConvertToJetMap(err,rgb);
+		apply_mask(m_mask,rgb);
+		slib::image::Write(rgb,slib::format("gray-error-%s.bmp", suffix));
+
+		err=m_reliable;
+		err /= 0.5;
+		slib::image::ConvertToJetMap(err,rgb);
+		apply_mask(m_mask,rgb);
+		slib::image::Write(rgb,slib::format("phase-error-%s.bmp", suffix));
+	}
+
+	void apply_mask(const slib::Field<2,float>& mask, slib::Field<2,slib::CVector<3,float> >& img) const
+	{
+		for (int y=0; y<mask.size(1); y++)
+			for (int x=0; x<mask.size(0); x++)
+				if (mask.cell(x,y) < 1)
+					img.cell(x,y) = slib::make_vector(0,0,0);
+	}
+
+	void generate_mask(int y0, int y1)
+	{
+		int nbits = m_options.get_num_gray_planes(m_direction);
+		for (int y=y0; y<y1; y++) {
+			const slib::CRowSpans::row_t& r = m_region.row(y);
+			for (size_t i=0; i<r.size(); i++)
+				for (int x=r[i].x0; x<r[i].x1; x++)
+					if (m_gray_error.cell(x,y) < nbits-1)
+						m_mask.cell(x,y) = 1;
+					else
+						m_mask.cell(x,y) = 0;
+		}
+	}
+
+private:
+	// holes in the lit region narrower than REGION_GAP pixels are filled,
+	// and the region is grown by REGION_MARGIN pixels
+	enum { REGION_GAP = 16, REGION_MARGIN = 8 };
+	// pixels per side of the tiles of adaptive thresholds, a multiple of
+	// CFrameStack::BLOCK
+	enum { LEVEL_TILE = 32 };
+
+	int m_xor_base;
+	slib::Field<2,float> m_gray_map;
+	slib::Field<2,int> m_gray_error;
+	// decoding state
+	slib::Field<2,unsigned int> m_gray_code;
+	slib::Field<2,float> m_pending; // first image of a complementary pair
+	float m_pending_max;
+	slib::Field<2,float> m_phase_sum[2]; // cos and sin terms
+	slib::Field<2,float> m_middle; // DC term, the threshold of single gray-code images
+};
+
+inline
+CPatternDecoder *CGrayPhasePattern::CreateDecoder(int direction) const
+{
+	return new CGrayPhaseDecoder(m_options, direction, m_xor_base);
+}
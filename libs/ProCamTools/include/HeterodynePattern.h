@@ -0,0 +1,332 @@
+//
+// This file is part of ofxActiveScan.
+//
+// multi-frequency heterodyne phase shifting.
+// fringes of three slightly different periods are phase shifted; the
+// beat of their wrapped phases spans the whole projector, so the
+// coordinate is unwrapped without gray code. with four shifts a scan of
+// both directions takes 24 images instead of the 56 of gray code and
+// phase shifting.
+//
+
+#pragma once
+
+#include <cmath>
+
+#include "Field.h"
+#include "FrameView.h"
+#include "RowSpans.h"
+#include "ImageBmpIO.h"
+
+#include "Options.h"
+#include "GrayCode.h"
+#include "PatternFamily.h"
+
+class CHeterodynePattern : public CPatternFamily
+{
+public:
+	enum { MAX_PERIODS = 3 };
+
+	// two periods would have to be about sqrt(fringes) times wider to
+	// unwrap in one step, too wide to locate a projector pixel
+	CHeterodynePattern(const options_t& o)
+		: CPatternFamily(o), m_nperiods(MAX_PERIODS), m_nshifts(std::max(o.heterodyne_shifts, 3))
+	{
+		if (o.heterodyne_periods != MAX_PERIODS)
+			throw std::runtime_error("heterodyne patterns need three periods");
+	}
+
+	const char *GetName(void) const {
+		return "heterodyne";
+	}
+
+	int GetNumImages(int /* direction */) const {
+		return m_nperiods * m_nshifts;
+	}
+
+	// a phase image takes about 4 operations, the arctangent 25 and each
+	// unwrapping step 15
+	int GetDecodeCost(int /* direction */) const {
+		return m_nperiods * (4 * m_nshifts + 25) + 15 * (m_nperiods - 1) + 10;
+	}
+
+	// the fringes of each period in turn, finest first
+	void GetProfile(int direction, int id, std::vector<unsigned char>& profile) const {
+		float periods[MAX_PERIODS], span;
+		GetPeriods(direction, periods, span);
+		slib::GenerateFringeProfile(periods[id / m_nshifts], (double)(id % m_nshifts) / m_nshifts, GetProfileSize(direction), profile);
+	}
+
+	int GetStage(int direction, int count, int& done, int& total) const {
+		done = count;
+		total = GetNumImages(direction);
+		return STAGE_PHASE;
+	}
+
+	CPatternDecoder *CreateDecoder(int direction) const;
+
+	int GetNumPeriods(void) const { return m_nperiods; }
+	int GetNumShifts(void) const { return m_nshifts; }
+
+	// periods of the fringes in pixel, finest first, and the span of
+	// their beat, which covers the projector with a period of
+	// options_t::get_fringe_period() to spare.
+	// the finest period is that period, and the number of fringes over
+	// the span decreases by 'a' and then 'a-1'. 'a' is taken up to
+	// 2*sqrt(fringes) where the phase noise get_tolerated_noise() allows
+	// is the largest.
+	void GetPeriods(int direction, float *periods, float& span) const {
+		int size = direction ? m_options.projector_height : m_options.projector_width;
+		int period = m_options.get_fringe_period();
+		int fmax = size / period + 1;
+		span = (float)fmax * period;
+
+		int a = 2;
+		float best = 0;
+		for (int b = 2; b * b <= 4 * fmax && 2 * b < fmax; b++) {
+			float noise = get_tolerated_noise(fmax, b);
+			if (noise > best) {
+				best = noise;
+				a = b;
+			}
+		}
+		const int f[MAX_PERIODS] = { fmax, fmax - a, fmax - 2 * a + 1 };
+		for (int k = 0; k < m_nperiods; k++)
+			periods[k] = span / f[k];
+	}
+
+private:
+	// phase noise in cycles that unwrapping 'fmax', 'fmax-a' and
+	// 'fmax-2a+1' fringes tolerates: the first beat step amplifies it by
+	// about 'a' and the second by 'fmax/a', and the other codes leave
+	// GetHeterodyneTolerance() between them and the phases
+	static float get_tolerated_noise(int fmax, int a)
+	{
+		const float periods[MAX_PERIODS] = { 1.0f, (float)fmax / (fmax - a), (float)fmax / (fmax - 2 * a + 1) };
+		float gain = (float)std::max(sqrt(6.0) * a, sqrt(2.0) * fmax / a);
+		float tolerance = slib::GetHeterodyneTolerance(periods, (float)fmax);
+		return std::min(tolerance / (float)sqrt(2.0), 0.25f / gain);
+	}
+
+	int m_nperiods;
+	int m_nshifts; // phase shifts per period
+};
+
+class CHeterodyneDecoder : public CPatternDecoder
+{
+public:
+	CHeterodyneDecoder(const options_t& o, int direction, const CHeterodynePattern& family)
+		: CPatternDecoder(o, direction), m_nperiods(family.GetNumPeriods()), m_nshifts(family.GetNumShifts()),
+		m_size((float)family.GetProfileSize(direction))
+	{
+		family.GetPeriods(direction, m_periods, m_span);
+	}
+
+	void AddImage(int index, const slib::Field<2,float>& image) {
+		add(index, image);
+	}
+
+	void AddImage(int index, const slib::CFrameView& frame) {
+		add(index, frame);
+	}
+
+	// each period is decoded from the stack into its phase, so the sums
+	// of the streaming decoder are not needed
+	bool CanDecodeStack(void) const { return true; }
+
+	void BeginStack(const slib::CFrameStack& stack, int /* first */)
+	{
+		const slib::CVector<2,int>& size = stack.size();
+		m_region.Initialize(size);
+		initialize_maps(size);
+		m_amplitude.Initialize(size);
+		for (int k = 0; k < m_nperiods; k++)
+			m_phase[k].Initialize(size);
+		m_phase_sum[0].Initialize(size);
+	}
+
+	void DecodeStack(const slib::CFrameStack& stack, int first, int y0, int y1)
+	{
+		// the maximum of the finest fringes stands for that of their
+		// peak, as in the streaming decoder
+		float maxval = 0;
+		for (int t = 0; t < m_nshifts; t++)
+			maxval = std::max(maxval, stack.GetMax(first + t) / 65535.0f);
+		float threshold = 0.5f * m_options.intensity_threshold * maxval;
+
+		// the amplitudes of the coarser fringes are discarded
+		for (int k = 0; k < m_nperiods; k++)
+			DecodePhaseCodeStack(stack, first + k * m_nshifts, m_nshifts, m_phase[k], k ? m_phase_sum[0] : m_amplitude, y0, y1);
+		UnwrapHeterodyne(m_phase, m_periods, m_span, m_size, m_amplitude, threshold, m_map, m_reliable, m_mask, m_region, y0, y1);
+	}
+
+	void EndStack(void)
+	{
+		finish();
+		m_phase_sum[0].Invalidate();
+	}
+
+private:
+	template <typename image_t>
+	void add(int index, const image_t& image)
+	{
+		int nphases = m_nshifts;
+		int k = index / nphases, t = index % nphases;
+		slib::Field<2,float> *sum = m_phase_sum;
+		if (index == 0) {
+			m_region.Initialize(image.size());
+			m_middle.Initialize(image.size());
+			m_middle.Clear(0);
+		}
+		if (t == 0) {
+			for (int i = 0; i < 2; i++) {
+				sum[i].Initialize(image.size());
+				sum[i].Clear(0);
+			}
+		}
+
+		// the DC term is taken from the finest fringes
+		m_pool->ParallelFor(0, image.size(1), [&](int y0, int y1) {
+			if (k == 0)
+				AccumulatePhaseCodeImage(image, t, nphases, sum[0], sum[1], m_middle, m_region, y0, y1);
+			else
+				AccumulatePhaseCodeImage(image, t, nphases, sum[0], sum[1], m_region, y0, y1);
+		});
+
+		if (t == nphases-1) {
+			// only the amplitude of the finest fringes is kept; the others
+			// are written over the sin terms, which are no longer needed
+			m_phase[k].Initialize(image.size());
+			if (k == 0) {
+				m_amplitude.Initialize(image.size());
+				m_amplitude.Clear(0);
+			}
+			slib::Field<2,float>& amplitude = k ? sum[1] : m_amplitude;
+			m_pool->ParallelFor(0, image.size(1), [&](int y0, int y1) {
+				DecodePhaseCodeSums(sum[0], sum[1], nphases, m_phase[k], amplitude, m_region, y0, y1);
+			});
+			sum[0].Invalidate();
+			sum[1].Invalidate();
+		}
+
+		if (index == m_nperiods * nphases - 1)
+			decode(image.size());
+	}
+
+	void initialize_maps(const slib::CVector<2,int>& size)
+	{
+		m_map.Initialize(size);
+		m_map.Clear(0);
+		m_reliable.Initialize(size);
+		m_reliable.Clear(0);
+		m_mask.Initialize(size);
+		m_mask.Clear(0);
+	}
+
+	void decode(const slib::CVector<2,int>& size)
+	{
+		initialize_maps(size);
+
+		// decodable where the peak-to-peak modulation of the finest fringes
+		// exceeds the threshold of a complementary pair
+		float maxval = reduce_max(size[1], [&](int y0, int y1) {
+			return get_max_intensity(y0, y1);
+		});
+		float threshold = 0.5f * m_options.intensity_threshold * maxval;
+		m_pool->ParallelFor(0, size[1], [&](int y0, int y1) {
+			UnwrapHeterodyne(m_phase, m_periods, m_span, m_size, m_amplitude, threshold, m_map, m_reliable, m_mask, m_region, y0, y1);
+		});
+		finish();
+		m_middle.Invalidate();
+	}
+
+	void finish(void)
+	{
+		reject_noisy();
+		if (m_options.debug) {
+			const char *suffix = get_suffix();
+			WriteCorrespondenceMap(m_map, m_mask, slib::format("phase-%s.bmp", suffix), 1.0f / m_span);
+			ExportCorrespondencePlot(m_map, m_mask, slib::format("phase-%s.dat", suffix));
+		}
+		for (int k = 0; k < m_nperiods; k++)
+			m_phase[k].Invalidate();
+	}
+
+	// a code only a few times the phase noise off the phases may be wrong,
+	// so pixels whose noise exceeds the tolerance of UnwrapHeterodyne()
+	// are not reliable. the noise is that of the camera over the amplitude
+	// of the finest fringes. the camera noise is estimated from the
+	// disagreement of the second fringes with the codes times that
+	// amplitude, whose median is 0.67 of its standard deviation, over the
+	// brighter half of the masked pixels, where the amplitude is not so low
+	// that any code would do; the wrong codes among them only raise it.
+	void reject_noisy(void)
+	{
+		std::vector<float> samples;
+		for_each(m_mask, [&](int x, int y) {
+			samples.push_back(m_amplitude.cell(x,y));
+		});
+		if (samples.empty())
+			return;
+		std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+		const float bright = samples[samples.size() / 2];
+
+		samples.clear();
+		for_each(m_mask, [&](int x, int y) {
+			if (m_amplitude.cell(x,y) >= bright) {
+				float r = m_map.cell(x,y) / m_periods[1] - m_phase[1].cell(x,y);
+				samples.push_back(std::abs(r - (float)floor(r + 0.5f)) * m_amplitude.cell(x,y));
+			}
+		});
+		std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+		float sigma = samples[samples.size() / 2] / 0.6745f;
+		float amplitude = sigma / slib::GetHeterodyneTolerance(m_periods, m_span);
+		for_each(m_reliable, [&](int x, int y) {
+			if (m_amplitude.cell(x,y) < amplitude)
+				m_reliable.cell(x,y) = 0;
+		});
+	}
+
+	// calls func(x, y) for the pixels of the region where 'flags' is set
+	template <typename function_t>
+	void for_each(const slib::Field<2,float>& flags, function_t func) const
+	{
+		for (int y = 0; y < m_map.size(1); y++) {
+			const slib::CRowSpans::row_t& r = m_region.row(y);
+			for (size_t i = 0; i < r.size(); i++)
+				for (int x = r[i].x0; x < r[i].x1; x++)
+					if (flags.cell(x,y) > 0)
+						func(x, y);
+		}
+	}
+
+	// maximum intensity of the finest fringes in rows [y0,y1)
+	float get_max_intensity(int y0, int y1) const
+	{
+		float m = -std::numeric_limits<float>::max();
+		for (int y = y0; y < y1; y++) {
+			const slib::CRowSpans::row_t& r = m_region.row(y);
+			for (size_t i = 0; i < r.size(); i++)
+				for (int x = r[i].x0; x < r[i].x1; x++)
+					m = std::max(m, m_middle.cell(x,y) + m_amplitude.cell(x,y));
+		}
+		return m;
+	}
+
+private:
+	int m_nperiods;
+	int m_nshifts;
+	float m_periods[CHeterodynePattern::MAX_PERIODS];
+	float m_span;
+	float m_size; // projector pixels of the direction
+	// decoding state
+	slib::Field<2,float> m_phase_sum[2]; // cos and sin terms of the current period; scratch amplitude of a stack
+	slib::Field<2,float> m_phase[CHeterodynePattern::MAX_PERIODS]; // wrapped phase of each period
+	slib::Field<2,float> m_middle; // DC term
+};
+
+inline
+CPatternDecoder *CHeterodynePattern::CreateDecoder(int direction) const
+{
+	return new CHeterodyneDecoder(m_options, direction, *this);
+}
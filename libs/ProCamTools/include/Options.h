@@ -6,11 +6,19 @@
 //
 
 #pragma once
+#include <algorithm>
 #include "MiscUtil.h"
 #include "IniFile.h"
 
 struct options_t
 {
+	// pattern families
+	enum {
+		PATTERN_GRAYCODE,	// gray code and phase shifting
+		PATTERN_XOR,		// XOR code and phase shifting
+		PATTERN_HETERODYNE	// multi-frequency phase shifting
+	};
+
 // projector dimension
 	int projector_width;					
 	int projector_height;					
@@ -21,14 +29,23 @@ struct options_t
 // 0.87;	// for EMP1735W 16:10
 // 0.86;	// for EMP1735W 4:3
 	float projector_horizontal_center;
-	int num_fringes;				// number of sinusoidal pattern
-	int fringe_interval;
+	int num_fringes;				// number of sinusoidal pattern (3 or more)
+	int fringe_interval;			// phase shift between sinusoidal patterns in pixel
 	bool horizontal;			// coding in horizontal direction
 	bool vertical;				// coding in vertical direction
-	bool complementary;			// OBSOLETE: binarize images using complementary patterns; otherwise thresholding is used
+	bool complementary;			// binarize images using complementary patterns; otherwise thresholding against the phase DC term is used
 	bool debug;					// debug
 	float intensity_threshold;
 	int nsamples;
+	bool roi;					// decode only the region lit by the first gray-code pair
+	int pattern;				// pattern family
+	int xor_base;				// base level of XOR codes: 0 for XOR-02, 1 for XOR-04
+	int heterodyne_periods;		// fringe periods of heterodyne patterns (3)
+	int heterodyne_shifts;		// phase shifts of each heterodyne period (3 or more)
+	bool color;					// carry three images in the R, G and B channels of each projected frame
+	int gray_skip[2];			// finest gray-code planes left out of each direction; see set_footprint()
+	float min_decodable;		// fraction of the camera pixels the first gray-code pair must decode, or the scan is rejected (0: no check)
+	bool adaptive_threshold;	// thresholds relative to the level of each tile of the first gray-code images instead of the maximum of each image
 
 	options_t() : 
 		projector_width(1024), projector_height(768), projector_horizontal_center(0.5),	// projector 
@@ -37,7 +54,14 @@ struct options_t
 		complementary(true), // binary code
 		debug(false), // debug flag
 		intensity_threshold(0.1), // mask threshold
-		nsamples(0) // 0=no subsampling
+		nsamples(0), // 0=no subsampling
+		roi(true), // region of interest
+		pattern(PATTERN_GRAYCODE), xor_base(1), // pattern family
+		heterodyne_periods(3), heterodyne_shifts(4), // 24 images for both directions
+		color(false), // color multiplexing
+		gray_skip(), // all gray-code planes
+		min_decodable(0), // no early rejection
+		adaptive_threshold(false) // global thresholds
 	{
 	}
 
@@ -61,13 +85,65 @@ struct options_t
 		intensity_threshold = ini.GetFloat("reconstruction","threshold");
 		nsamples = ini.GetInt("reconstruction","nsamples");
 
+		// optional; files without these keep the defaults
+		pattern = ini.GetInt("pattern","family",pattern); // 0: gray code, 1: XOR, 2: heterodyne
+		xor_base = ini.GetInt("pattern","xor_base",xor_base);
+		color = ini.GetBool("pattern","color",color);
+		if (ini.HasKey("pattern","footprint")) {
+			set_footprint(0, (float)ini.GetFloat("pattern","footprint"));
+			set_footprint(1, (float)ini.GetFloat("pattern","footprint"));
+		}
+		gray_skip[0] = ini.GetInt("pattern","gray_skip_horizontal",gray_skip[0]);
+		gray_skip[1] = ini.GetInt("pattern","gray_skip_vertical",gray_skip[1]);
+
+		heterodyne_periods = ini.GetInt("heterodyne","periods",heterodyne_periods);
+		heterodyne_shifts = ini.GetInt("heterodyne","shifts",heterodyne_shifts);
+
+		roi = ini.GetBool("reconstruction","roi",roi);
+		min_decodable = (float)ini.GetFloat("reconstruction","min_decodable",min_decodable);
+		adaptive_threshold = ini.GetBool("reconstruction","adaptive_threshold",adaptive_threshold);
+
 		ini.Dump();
 	}
 
+	// phase period of sinusoidal patterns in pixel
+	int get_fringe_period() const {
+		return num_fringes * fringe_interval;
+	}
+
 	int get_num_bits(int direction) const {
 		if (direction)
 			return  ceilf(logf(projector_height) / logf(2));
 		else 
 			return  ceilf(logf(projector_width) / logf(2));
 	}
+
+	// finest gray-code planes left out of 'direction'.
+	// the phase has to find the coordinate within the stripes of the
+	// finest plane projected, so at most log2(period)-1 planes are left
+	// out. XOR codes whose base level is left out are based on the finest
+	// plane projected instead.
+	int get_gray_skip(int direction) const {
+		int period = get_fringe_period();
+		int n = 0;
+		while (period >> (n + 2))
+			n++;
+		return std::min(std::max(gray_skip[direction], 0), n);
+	}
+
+	// gray-code planes projected for 'direction'
+	int get_num_gray_planes(int direction) const {
+		return get_num_bits(direction) - get_gray_skip(direction);
+	}
+
+	// leave out the gray-code planes of 'direction' whose stripes are
+	// narrower than two camera pixels, where a projector pixel covers
+	// 1/'footprint' camera pixels, as measured by EstimateFootprint().
+	// the stripes of level l are 2^(l+1) projector pixels wide.
+	void set_footprint(int direction, float footprint) {
+		int n = 0;
+		while (n < 16 && (float)(1 << n) < footprint)
+			n++;
+		gray_skip[direction] = n;
+	}
 };
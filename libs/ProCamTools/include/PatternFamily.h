@@ -0,0 +1,192 @@
+//
+// This file is part of ofxActiveScan.
+//
+// a family of structured-light patterns: the images projected for each
+// direction, and a decoder that folds the captured images of a direction
+// into a map of projector coordinates. CEncode and CDecode only go
+// through this interface, so that an installation can trade frame count
+// against robustness by choosing the family in options_t.
+//
+
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#include "Field.h"
+#include "FrameView.h"
+#include "FrameStack.h"
+#include "RowSpans.h"
+#include "TileHistogram.h"
+#include "ThreadPool.h"
+
+#include "Options.h"
+#include "GrayCode.h"
+
+class CPatternDecoder;
+
+class CPatternFamily
+{
+public:
+	// decoding stages reported as progress
+	enum { STAGE_CODE, STAGE_PHASE };
+
+	CPatternFamily(const options_t& o) : m_options(o) {}
+	virtual ~CPatternFamily() {}
+
+	virtual const char *GetName(void) const = 0;
+
+	// images projected for 'direction' (0: horizontal, 1: vertical)
+	virtual int GetNumImages(int direction) const = 0;
+
+	// approximate arithmetic operations per camera pixel to decode 'direction'
+	virtual int GetDecodeCost(int direction) const = 0;
+
+	// values of the 'id'-th image of 'direction' along x (direction 0) or
+	// y (direction 1); every pattern varies along that axis only
+	virtual void GetProfile(int direction, int id, std::vector<unsigned char>& profile) const = 0;
+
+	// 'id'-th image of 'direction', its profile replicated over the rows.
+	// 'image' must be initialized to the projector size.
+	void GetImage(int direction, int id, slib::Field<2,unsigned char>& image) const {
+		std::vector<unsigned char> profile;
+		GetProfile(direction, id, profile);
+		slib::ExpandProfile(direction, &profile[0], image);
+	}
+
+	// length of the profiles of 'direction'
+	int GetProfileSize(int direction) const {
+		return direction ? m_options.projector_height : m_options.projector_width;
+	}
+
+	// stage of the decoder after 'count' images of 'direction', with the
+	// images done and in total of that stage
+	virtual int GetStage(int direction, int count, int& done, int& total) const = 0;
+
+	// decoder of the images of 'direction', owned by the caller
+	virtual CPatternDecoder *CreateDecoder(int direction) const = 0;
+
+	const options_t& GetOptions(void) const { return m_options; }
+
+protected:
+	options_t m_options;
+};
+
+// decoder of the images of one direction.
+// once the last image is added, the map holds the projector coordinate of
+// each camera pixel, the mask is 1 where the code was decoded, and the
+// reliable map is 1 where the coordinate is accurate to a pixel.
+// the maps are 0 outside the region.
+class CPatternDecoder
+{
+public:
+	CPatternDecoder(const options_t& o, int direction)
+		: m_options(o), m_direction(direction), m_pool(&slib::CThreadPool::GetShared()),
+		m_quality(false), m_contrast(0), m_decodable(0) {}
+	virtual ~CPatternDecoder() {}
+
+	// stages run in row tiles on 'pool'
+	void SetThreadPool(slib::CThreadPool& pool) {
+		m_pool = &pool;
+	}
+
+	// add the 'index'-th image; images must be added in order.
+	// frames are only read during the call.
+	virtual void AddImage(int index, const slib::Field<2,float>& image) = 0;
+	virtual void AddImage(int index, const slib::CFrameView& frame) = 0;
+
+	// decoders that can decode pixel-major frames row by row decode rows
+	// [y0,y1) from frames [first,first+n) of 'stack' between BeginStack()
+	// and EndStack(), so that CDecode can interleave the directions.
+	virtual bool CanDecodeStack(void) const { return false; }
+	virtual void BeginStack(const slib::CFrameStack& /* stack */, int /* first */) {}
+	virtual void DecodeStack(const slib::CFrameStack& /* stack */, int /* first */, int /* y0 */, int /* y1 */) {}
+	virtual void EndStack(void) {}
+
+	// measure GetQuality() on the frames of 'stack' from 'first', which
+	// must hold the images AddImage() measures it on, so that a stack is
+	// checked the same way as a stream
+	virtual void MeasureQuality(const slib::CFrameStack& /* stack */, int /* first */) {}
+
+	const slib::Field<2,float>& GetMap(void) const { return m_map; }
+	const slib::Field<2,float>& GetMask(void) const { return m_mask; }
+	const slib::Field<2,float>& GetReliable(void) const { return m_reliable; }
+
+	// modulation amplitude of the sinusoidal patterns
+	const slib::Field<2,float>& GetAmplitude(void) const { return m_amplitude; }
+
+	// pixels lit by the projector; every stage after the detection of the
+	// region only visits it
+	const slib::CRowSpans& GetRegion(void) const { return m_region; }
+
+	// quality of the scan measured on its first images, as soon as the
+	// family can tell it: the mean intensity difference between the
+	// images of the first complementary pair where the code decodes, as a
+	// fraction of the brightest intensity like intensity_threshold, and
+	// the fraction of the camera pixels where it does.
+	// returns false until it is measured, and for families that do not.
+	bool GetQuality(float& contrast, float& decodable) const {
+		contrast = m_contrast;
+		decodable = m_decodable;
+		return m_quality;
+	}
+
+	// intensity levels of the tiles of the first images with
+	// options_t::adaptive_threshold, invalid otherwise
+	const slib::CTileHistogram& GetLevels(void) const { return m_levels; }
+
+	// keep the pixels of the mask and the reliable map that are also set
+	// in 'other'
+	void Merge(const CPatternDecoder& other)
+	{
+		m_pool->ParallelFor(0, m_mask.size(1), [&](int y0, int y1) {
+			for (int y = y0; y < y1; y++)
+			{
+				const slib::CRowSpans::row_t& r = m_region.row(y);
+				for (size_t i = 0; i < r.size(); i++)
+				for (int x = r[i].x0; x < r[i].x1; x++)
+				{
+					if (!other.m_mask.cell(x, y))
+						m_mask.cell(x, y) = 0;
+					m_reliable.cell(x,y) = std::min(m_reliable.cell(x,y),other.m_reliable.cell(x,y));
+				}
+			}
+		});
+	}
+
+protected:
+	// maximum of func(y0, y1) over row tiles
+	template <typename function_t>
+	float reduce_max(int height, function_t func)
+	{
+		float maxval = -std::numeric_limits<float>::max();
+		std::mutex tile_mutex;
+		m_pool->ParallelFor(0, height, [&](int y0, int y1) {
+			float m = func(y0, y1);
+			std::lock_guard<std::mutex> lock(tile_mutex);
+			maxval = std::max(maxval, m);
+		});
+		return maxval;
+	}
+
+	const char *get_suffix(void) const {
+		return m_direction ? "v" : "h";
+	}
+
+protected:
+	options_t m_options;
+	int m_direction;
+	slib::CThreadPool *m_pool;
+	slib::Field<2,float> m_map;
+	slib::Field<2,float> m_mask;
+	slib::Field<2,float> m_reliable;
+	slib::Field<2,float> m_amplitude;
+	slib::CRowSpans m_region;
+	slib::CTileHistogram m_levels;
+	// early quality
+	bool m_quality;
+	float m_contrast;
+	float m_decodable;
+};
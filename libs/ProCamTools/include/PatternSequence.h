@@ -0,0 +1,400 @@
+//
+// This file is part of ofxActiveScan.
+//
+// precompiled pattern sequence.
+// Write() stores every frame of a CEncode in one file, and Open() maps it
+// back, so that a capture loop flips through ready frames instead of
+// generating and converting them on every run.
+// frames are stored raw, as their 1D profiles, or as run lengths of the
+// profiles; raw frames are read in place from the mapped file, the others
+// are expanded once when the file is opened.
+//
+
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "MiscUtil.h"
+
+#include "Options.h"
+#include "encode.h"
+#include "ColorMultiplex.h"
+
+class CPatternSequence
+{
+public:
+	enum {
+		FORMAT_RAW,		// frames as projected, read in place
+		FORMAT_PROFILE,	// 1D profile of each channel
+		FORMAT_RLE		// run lengths of each profile
+	};
+
+	CPatternSequence() : m_data(0), m_size(0) { std::memset(&m_header, 0, sizeof(m_header)); }
+	~CPatternSequence() { Close(); }
+
+	// write every frame of 'encoder' to 'filename'
+	static void Write(const CEncode& encoder, const std::string& filename, int format = FORMAT_PROFILE)
+	{
+		const options_t& o = encoder.GetFamily().GetOptions();
+		header_t header;
+		std::memcpy(header.magic, "ASPS", 4);
+		header.version = VERSION;
+		header.format = format;
+		header.width = o.projector_width;
+		header.height = o.projector_height;
+		header.channels = o.color ? 3 : 1;
+		header.nframes = encoder.GetNumImages();
+		header.reserved = 0;
+		header.options = GetOptionsHash(o);
+
+		// profiles and run lengths are small enough to encode up front
+		std::vector<std::vector<unsigned char> > blobs;
+		if (format != FORMAT_RAW) {
+			blobs.resize(header.nframes);
+			for (int id = 0; id < (int)header.nframes; id++)
+				encode_frame(encoder, header, format, id, blobs[id]);
+		}
+
+		size_t frame_size = (size_t)header.width * header.height * header.channels;
+		std::vector<entry_t> table(header.nframes);
+		uint64_t offset = align(sizeof(header_t) + sizeof(entry_t) * table.size());
+		for (size_t id = 0; id < table.size(); id++) {
+			table[id].offset = offset;
+			table[id].size = format == FORMAT_RAW ? frame_size : blobs[id].size();
+			offset = align(offset + table[id].size);
+		}
+		// Open() addresses the file with size_t
+		if (offset > (uint64_t)SIZE_MAX)
+			slib::ThrowRuntimeError("%s: too large to open on this platform", filename.c_str());
+
+		FILE *fp = fopen(filename.c_str(), "wb");
+		if (!fp)
+			slib::ThrowRuntimeError("failed to open %s", filename.c_str());
+		bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+		if (!table.empty())
+			ok = ok && fwrite(&table[0], sizeof(entry_t), table.size(), fp) == table.size();
+
+		// raw frames are expanded from their profiles one at a time, without
+		// filling the cache of the encoder. frames are written in order and
+		// padded to their offsets rather than sought, as fseek() takes a long,
+		// which is 32 bits on Windows.
+		std::vector<unsigned char> blob, frame;
+		const unsigned char padding[ALIGNMENT] = { 0 };
+		uint64_t written = sizeof(header_t) + sizeof(entry_t) * table.size();
+		for (size_t id = 0; ok && id < table.size(); id++) {
+			size_t pad = (size_t)(table[id].offset - written);
+			ok = pad == 0 || fwrite(padding, 1, pad, fp) == pad;
+			written = table[id].offset + table[id].size;
+			const std::vector<unsigned char> *src = &frame;
+			if (format == FORMAT_RAW) {
+				blob.clear();
+				encode_frame(encoder, header, FORMAT_PROFILE, id, blob);
+				decode_frame(header, FORMAT_PROFILE, &blob[0], blob.size(), frame);
+			} else {
+				src = &blobs[id];
+			}
+			ok = ok && fwrite(&(*src)[0], 1, table[id].size, fp) == table[id].size;
+		}
+		ok = (fclose(fp) == 0) && ok;
+		if (!ok)
+			slib::ThrowRuntimeError("failed to write %s", filename.c_str());
+	}
+
+	// map 'filename'
+	void Open(const std::string& filename)
+	{
+		Close();
+		map(filename);
+
+		if (m_size < sizeof(header_t))
+			fail(filename, "truncated");
+		std::memcpy(&m_header, m_data, sizeof(header_t));
+		if (std::memcmp(m_header.magic, "ASPS", 4) != 0 || m_header.version != VERSION)
+			fail(filename, "not a pattern sequence");
+		if (m_header.format > (uint32_t)FORMAT_RLE || (m_header.channels != 1 && m_header.channels != 3))
+			fail(filename, "unsupported format");
+		if (m_size < sizeof(header_t) + sizeof(entry_t) * (size_t)m_header.nframes)
+			fail(filename, "truncated");
+
+		m_table.resize(m_header.nframes);
+		if (!m_table.empty())
+			std::memcpy(&m_table[0], m_data + sizeof(header_t), sizeof(entry_t) * m_table.size());
+		size_t frame_size = GetFrameSize();
+		for (size_t id = 0; id < m_table.size(); id++) {
+			if (m_table[id].offset > m_size || m_table[id].size > m_size - m_table[id].offset)
+				fail(filename, "truncated");
+			if (m_header.format == FORMAT_RAW && m_table[id].size != frame_size)
+				fail(filename, "corrupted");
+		}
+
+		if (m_header.format != FORMAT_RAW) {
+			m_frames.resize(m_table.size());
+			for (size_t id = 0; id < m_table.size(); id++)
+				if (!decode_frame(m_header, m_header.format, m_data + m_table[id].offset, m_table[id].size, m_frames[id]))
+					fail(filename, "corrupted");
+		}
+	}
+
+	// map 'filename', which must have been written for options 'o'
+	void Open(const std::string& filename, const options_t& o)
+	{
+		Open(filename);
+		if (m_header.options != GetOptionsHash(o))
+			fail(filename, "written for other options");
+	}
+
+	void Close(void)
+	{
+		unmap();
+		m_table.clear();
+		m_frames.clear();
+		std::memset(&m_header, 0, sizeof(m_header));
+	}
+
+	bool IsOpen(void) const { return m_data != 0; }
+
+	int GetNumImages(void) const { return m_header.nframes; }
+	int GetWidth(void) const { return m_header.width; }
+	int GetHeight(void) const { return m_header.height; }
+	int GetChannels(void) const { return m_header.channels; }
+	int GetFormat(void) const { return m_header.format; }
+
+	// bytes of a frame: rows of GetWidth() pixels of GetChannels() bytes
+	size_t GetFrameSize(void) const {
+		return (size_t)m_header.width * m_header.height * m_header.channels;
+	}
+
+	// the 'id'-th frame, valid until the sequence is closed
+	const unsigned char *GetImage(int id) const
+	{
+		if (id < 0 || id >= (int)m_header.nframes)
+			throw std::runtime_error("invalid image id");
+		if (m_header.format == FORMAT_RAW)
+			return m_data + m_table[id].offset;
+		return &m_frames[id][0];
+	}
+
+	// fingerprint of the options that change the patterns
+	static uint64_t GetOptionsHash(const options_t& o)
+	{
+		const int values[] = {
+			o.projector_width, o.projector_height, o.num_fringes, o.fringe_interval,
+			o.horizontal, o.vertical, o.complementary, o.pattern, o.xor_base,
+			o.heterodyne_periods, o.heterodyne_shifts, o.color,
+			o.get_gray_skip(0), o.get_gray_skip(1)
+		};
+		// FNV-1a
+		uint64_t hash = 14695981039346656037ULL;
+		for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+			for (int b = 0; b < 4; b++) {
+				hash ^= (values[i] >> (8 * b)) & 0xff;
+				hash *= 1099511628211ULL;
+			}
+		return hash;
+	}
+
+private:
+	enum { VERSION = 1, ALIGNMENT = 64 };
+
+	struct header_t {
+		char magic[4];
+		uint32_t version;
+		uint32_t format;
+		uint32_t width, height, channels;
+		uint32_t nframes;
+		uint32_t reserved;
+		uint64_t options; // GetOptionsHash()
+	};
+
+	struct entry_t {
+		uint64_t offset; // from the beginning of the file
+		uint64_t size; // in bytes
+	};
+
+	// each channel of an encoded frame starts with its direction, 0 or 1,
+	// or NONE for a black channel. a profile follows as is, or as runs.
+	enum { NONE = 2 };
+
+	struct run_t {
+		uint16_t length; // longer runs are split
+		uint8_t value;
+		uint8_t reserved;
+	};
+
+	static uint64_t align(uint64_t offset) {
+		return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	}
+
+	static void append(std::vector<unsigned char>& blob, const void *data, size_t size) {
+		const unsigned char *p = static_cast<const unsigned char *>(data);
+		blob.insert(blob.end(), p, p + size);
+	}
+
+	static void encode_frame(const CEncode& encoder, const header_t& header, int format, int id, std::vector<unsigned char>& blob)
+	{
+		std::vector<unsigned char> profile;
+		for (int c = 0; c < (int)header.channels; c++) {
+			int j = header.channels == 3 ? GetColorPlane(encoder.GetNumPlanes(), id, c) : id;
+			uint32_t direction = j < 0 ? (uint32_t)NONE : (uint32_t)encoder.GetDirection(j);
+			append(blob, &direction, sizeof(direction));
+			if (j < 0)
+				continue;
+			encoder.GetProfile(j, profile);
+			if (format == FORMAT_PROFILE) {
+				append(blob, &profile[0], profile.size());
+				continue;
+			}
+			std::vector<run_t> runs;
+			for (size_t i = 0; i < profile.size(); i++) {
+				if (runs.empty() || runs.back().value != profile[i] || runs.back().length == 0xffff) {
+					run_t r = { 0, profile[i], 0 };
+					runs.push_back(r);
+				}
+				runs.back().length++;
+			}
+			uint32_t nruns = (uint32_t)runs.size();
+			append(blob, &nruns, sizeof(nruns));
+			append(blob, &runs[0], sizeof(run_t) * runs.size());
+		}
+	}
+
+	// expand the 'size' bytes of profiles or runs at 'p' into 'frame';
+	// false if corrupted
+	static bool decode_frame(const header_t& header, int format, const unsigned char *p, size_t size, std::vector<unsigned char>& frame)
+	{
+		const int w = header.width, h = header.height, nc = header.channels;
+		const unsigned char *end = p + size;
+		frame.assign((size_t)w * h * nc, 0);
+		std::vector<unsigned char> profile;
+		for (int c = 0; c < nc; c++) {
+			uint32_t direction;
+			if (end - p < (ptrdiff_t)sizeof(direction))
+				return false;
+			std::memcpy(&direction, p, sizeof(direction));
+			p += sizeof(direction);
+			if (direction == NONE)
+				continue;
+			if (direction > 1)
+				return false;
+
+			size_t length = direction ? h : w;
+			if (format == FORMAT_PROFILE) {
+				if ((size_t)(end - p) < length)
+					return false;
+				profile.assign(p, p + length);
+				p += length;
+			} else {
+				uint32_t nruns;
+				if (end - p < (ptrdiff_t)sizeof(nruns))
+					return false;
+				std::memcpy(&nruns, p, sizeof(nruns));
+				p += sizeof(nruns);
+				if ((size_t)(end - p) < sizeof(run_t) * (size_t)nruns)
+					return false;
+				profile.clear();
+				for (uint32_t i = 0; i < nruns; i++, p += sizeof(run_t)) {
+					run_t r;
+					std::memcpy(&r, p, sizeof(r));
+					profile.insert(profile.end(), std::min<size_t>(r.length, length - profile.size()), r.value);
+				}
+				if (profile.size() != length)
+					return false;
+			}
+
+			for (int y = 0; y < h; y++) {
+				unsigned char *dst = &frame[(size_t)y * w * nc];
+				if (nc == 1) {
+					if (direction == 0)
+						std::memcpy(dst, &profile[0], w);
+					else
+						std::memset(dst, profile[y], w);
+				} else {
+					for (int x = 0; x < w; x++)
+						dst[x * nc + c] = profile[direction ? y : x];
+				}
+			}
+		}
+		return true;
+	}
+
+	void fail(const std::string& filename, const char *reason)
+	{
+		Close();
+		slib::ThrowRuntimeError("%s: %s", filename.c_str(), reason);
+	}
+
+#if defined(_WIN32)
+	// read the whole file; frames are still read in place from the buffer
+	void map(const std::string& filename)
+	{
+		std::ifstream in(filename.c_str(), std::ios::binary);
+		if (!in)
+			slib::ThrowRuntimeError("failed to open %s", filename.c_str());
+		m_buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+		m_size = m_buffer.size();
+		m_data = m_buffer.empty() ? 0 : reinterpret_cast<const unsigned char *>(&m_buffer[0]);
+		if (!m_data)
+			slib::ThrowRuntimeError("failed to read %s", filename.c_str());
+	}
+
+	void unmap(void)
+	{
+		std::vector<char>().swap(m_buffer);
+		m_data = 0;
+		m_size = 0;
+	}
+#else
+	void map(const std::string& filename)
+	{
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0)
+			slib::ThrowRuntimeError("failed to open %s", filename.c_str());
+		struct stat st;
+		void *p = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+			p = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (p == MAP_FAILED)
+			slib::ThrowRuntimeError("failed to map %s", filename.c_str());
+		m_data = static_cast<const unsigned char *>(p);
+		m_size = st.st_size;
+	}
+
+	void unmap(void)
+	{
+		if (m_data)
+			munmap(const_cast<unsigned char *>(m_data), m_size);
+		m_data = 0;
+		m_size = 0;
+	}
+#endif
+
+private:
+	CPatternSequence(const CPatternSequence&);
+	CPatternSequence& operator=(const CPatternSequence&);
+
+	const unsigned char *m_data; // the file
+	size_t m_size;
+#if defined(_WIN32)
+	std::vector<char> m_buffer;
+#endif
+	header_t m_header;
+	std::vector<entry_t> m_table;
+	std::vector<std::vector<unsigned char> > m_frames; // expanded frames
+};
@@ -0,0 +1,26 @@
+//
+// This file is part of ofxActiveScan.
+//
+// pattern families selectable in options_t.
+//
+
+#pragma once
+
+#include "Options.h"
+#include "PatternFamily.h"
+#include "GrayPhasePattern.h"
+#include "HeterodynePattern.h"
+
+// family selected by 'o.pattern', owned by the caller
+inline
+CPatternFamily *CreatePatternFamily(const options_t& o)
+{
+	switch (o.pattern) {
+	case options_t::PATTERN_XOR:
+		return new CGrayPhasePattern(o, o.xor_base);
+	case options_t::PATTERN_HETERODYNE:
+		return new CHeterodynePattern(o);
+	default:
+		return new CGrayPhasePattern(o);
+	}
+}
@@ -596,7 +596,8 @@ inline int ReadBmp(
 	}
 
     fseek(fr, 10, SEEK_CUR);
-    unsigned long offset;
+    // 4-byte fields; long may be wider
+    unsigned long offset = 0;
     fread(&offset, 4, 1, fr);
     fseek(fr, 4, SEEK_CUR);
     fread(w, 4, 1, fr);
@@ -612,7 +613,7 @@ inline int ReadBmp(
     }
 
     *ch /= 8;
-    unsigned long comp;
+    unsigned long comp = 0;
     fread(&comp, 4, 1, fr);
 
     if (!(comp==0 || comp==3))
@@ -234,6 +234,8 @@ public:
 	// accessor
 	T const *ptr() const { return m_cell; }
 
+	T *ptr() { return m_cell; }
+
 	T const& ptr(int i) const { return m_cell[i]; }
 
 	const CVector<nDimension,int>& size(void) const
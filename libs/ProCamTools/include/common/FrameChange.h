@@ -0,0 +1,147 @@
+//
+// This file is part of ofxActiveScan.
+//
+// detects that a camera frame differs from a reference frame, e.g. that a
+// new pattern became visible. every few rows of the frame are compared
+// byte by byte with sums of absolute differences, and the comparison stops
+// as soon as the rows seen so far settle the answer.
+//
+
+#pragma once
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+
+#include "Field.h"
+#include "FrameView.h"
+#include "Simd.h"
+
+namespace slib
+{
+
+// sum of max(|a-b| - noise, 0) over n bytes
+inline
+unsigned int SumAbsDiff(const unsigned char *a, const unsigned char *b, const unsigned char noise, const int n)
+{
+	unsigned int sum = 0;
+	int x = 0;
+#if defined(SLIB_SIMD_AVX2)
+	{
+		const __m256i vnoise = _mm256_set1_epi8((char)noise), vzero = _mm256_setzero_si256();
+		__m256i acc = vzero;
+		for (; x + 32 <= n; x += 32) {
+			__m256i va = _mm256_loadu_si256((const __m256i *)(a + x));
+			__m256i vb = _mm256_loadu_si256((const __m256i *)(b + x));
+			__m256i d = _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va));
+			acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_subs_epu8(d, vnoise), vzero));
+		}
+		unsigned long long lane[4];
+		_mm256_storeu_si256((__m256i *)lane, acc);
+		sum += (unsigned int)(lane[0] + lane[1] + lane[2] + lane[3]);
+	}
+#elif defined(SLIB_SIMD_SSE2)
+	{
+		const __m128i vnoise = _mm_set1_epi8((char)noise), vzero = _mm_setzero_si128();
+		__m128i acc = vzero;
+		for (; x + 16 <= n; x += 16) {
+			__m128i va = _mm_loadu_si128((const __m128i *)(a + x));
+			__m128i vb = _mm_loadu_si128((const __m128i *)(b + x));
+			__m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+			acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_subs_epu8(d, vnoise), vzero));
+		}
+		sum += (unsigned int)(_mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+	}
+#endif
+	for (; x < n; x++) {
+		int d = std::abs((int)a[x] - (int)b[x]) - noise;
+		if (d > 0)
+			sum += d;
+	}
+	return sum;
+}
+
+class CFrameChange
+{
+public:
+	CFrameChange() : m_step(4), m_noise(8), m_channels(0), m_rowsize(0), m_nrows(0), m_compared(0) { m_size[0] = m_size[1] = 0; }
+
+	// compare every 'step'-th row, ignoring differences up to 'noise' in
+	// [0,1] at each pixel. forgets the reference.
+	void Initialize(const int step = 4, const float noise = 0.03f)
+	{
+		m_step = std::max(step, 1);
+		m_noise = (unsigned char)std::min(std::max((int)(noise * 255 + 0.5f), 0), 255);
+		m_reference.clear();
+		m_nrows = 0;
+	}
+
+	bool HasReference(void) const { return m_nrows > 0; }
+
+	// keep the compared rows of 'frame'. 16-bit frames are kept and
+	// compared at 8 bits.
+	void SetReference(const CFrameView& frame)
+	{
+		m_size = frame.size();
+		m_channels = frame.channels();
+		m_rowsize = frame.size(0) * frame.channels();
+		m_nrows = (frame.size(1) + m_step - 1) / m_step;
+		m_reference.resize((size_t)m_nrows * m_rowsize);
+		for (int i = 0; i < m_nrows; i++) {
+			const unsigned char *row = get_row(frame, i);
+			std::copy(row, row + m_rowsize, &m_reference[(size_t)i * m_rowsize]);
+		}
+	}
+
+	// confidence in [0,1] that 'frame' differs from the reference: the mean
+	// difference above the noise over the compared rows, relative to
+	// 'threshold' in [0,1]. returns 1 as soon as the rows compared so far
+	// reach the threshold over the whole frame, and 1 for a frame of
+	// another size or a missing reference.
+	float Compare(const CFrameView& frame, const float threshold)
+	{
+		m_compared = 0;
+		if (!m_nrows || frame.size(0) != m_size[0] || frame.size(1) != m_size[1] || frame.channels() != m_channels)
+			return 1;
+		const double target = (double)threshold * 255 * m_nrows * m_rowsize;
+		double sum = 0;
+		for (int i = 0; i < m_nrows; i++) {
+			sum += SumAbsDiff(get_row(frame, i), &m_reference[(size_t)i * m_rowsize], m_noise, m_rowsize);
+			m_compared++;
+			if (sum >= target)
+				return 1;
+		}
+		return target > 0 ? (float)(sum / target) : 1.0f;
+	}
+
+	// rows read by the last Compare()
+	int GetComparedRows(void) const { return m_compared; }
+
+private:
+	// bytes of the 'i'-th compared row of 'frame'
+	const unsigned char *get_row(const CFrameView& frame, const int i)
+	{
+		const unsigned char *row = frame.data() + (size_t)i * m_step * frame.stride();
+		if (frame.depth() == 8)
+			return row;
+		m_buffer.resize(m_rowsize);
+		const unsigned short *src = reinterpret_cast<const unsigned short *>(row);
+		for (int x = 0; x < m_rowsize; x++)
+			m_buffer[x] = (unsigned char)(src[x] >> 8);
+		return &m_buffer[0];
+	}
+
+private:
+	int m_step;
+	unsigned char m_noise;
+	CVector<2,int> m_size;
+	int m_channels;
+	int m_rowsize; // bytes per row
+	int m_nrows; // compared rows
+	std::vector<unsigned char> m_reference;
+	std::vector<unsigned char> m_buffer; // a 16-bit row at 8 bits
+	int m_compared;
+};
+
+} // namespace slib
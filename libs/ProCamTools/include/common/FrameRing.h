@@ -0,0 +1,170 @@
+//
+// This file is part of ofxActiveScan.
+//
+// lock-free ring of frame buffers between one producer thread, e.g. the
+// camera, and one consumer thread, e.g. the decoder. the producer writes
+// each frame straight into a free buffer and the consumer reads it in
+// place, so a frame is copied at most once. buffers are allocated when
+// the ring is initialized and reused afterwards.
+//
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+#include "Field.h"
+#include "FrameView.h"
+
+namespace slib
+{
+
+class CFrameRing
+{
+public:
+	CFrameRing() : m_head(0), m_tail(0), m_dropped(0), m_overruns(0), m_write(0), m_read(0), m_full(false) {}
+
+	// 'capacity' buffers, each allocated for frames of 'width' x 'height'
+	// pixels of 'channels' channels of 'depth' bits, if given.
+	// the ring must not be in use.
+	void Initialize(const int capacity, const int width = 0, const int height = 0, const int channels = 1, const int depth = 8)
+	{
+		m_slots.assign(std::max(capacity, 1), slot_t());
+		for (size_t i = 0; i < m_slots.size(); i++)
+			m_slots[i].pixels.reserve((size_t)width * height * channels * depth / 8);
+		m_head = 0;
+		m_tail = 0;
+		m_dropped = 0;
+		m_overruns = 0;
+		m_write = 0;
+		m_read = 0;
+		m_full = false;
+	}
+
+	int GetCapacity(void) const { return (int)m_slots.size(); }
+
+	// frames written and not yet read
+	int GetCount(void) const { return (int)(m_head.load() - m_tail.load()); }
+	bool IsEmpty(void) const { return m_head.load() == m_tail.load(); }
+
+	// frames the producer dropped because every buffer was in use, and the
+	// times that happened after a frame was written, i.e. the times the
+	// consumer fell a whole ring behind
+	unsigned int GetDropped(void) const { return m_dropped.load(); }
+	unsigned int GetOverruns(void) const { return m_overruns.load(); }
+
+	//
+	// producer
+	//
+
+	// slot of the next frame, or -1 when the ring is full and the frame
+	// is to be dropped. the slot holds no frame until SetFrame() or
+	// GetBuffer().
+	int BeginWrite(void)
+	{
+		unsigned int head = m_head.load(std::memory_order_relaxed);
+		if (head - m_tail.load(std::memory_order_acquire) >= m_slots.size()) {
+			m_dropped++;
+			if (!m_full)
+				m_overruns++;
+			m_full = true;
+			return -1;
+		}
+		m_full = false;
+		m_slots[m_write].view = CFrameView();
+		m_slots[m_write].time = 0;
+		return m_write;
+	}
+
+	// buffer of 'slot' for a tightly packed frame of the given format, to
+	// be filled before EndWrite(); only reallocated when the frame is
+	// larger than any frame of the slot before
+	unsigned char *GetBuffer(const int slot, const int width, const int height, const int channels = 1, const int depth = 8)
+	{
+		slot_t& s = m_slots[slot];
+		s.pixels.resize((size_t)width * height * channels * depth / 8);
+		if (depth == 8)
+			s.view = CFrameView(&s.pixels[0], width, height, channels);
+		else
+			s.view = CFrameView(reinterpret_cast<const unsigned short *>(&s.pixels[0]), width, height, channels);
+		return &s.pixels[0];
+	}
+
+	// copy of 'frame' into 'slot'
+	void SetFrame(const int slot, const CFrameView& frame)
+	{
+		int rowsize = frame.size(0) * frame.channels() * frame.depth() / 8;
+		unsigned char *dst = GetBuffer(slot, frame.size(0), frame.size(1), frame.channels(), frame.depth());
+		for (int y = 0; y < frame.size(1); y++)
+			std::memcpy(dst + (size_t)y * rowsize, frame.data() + (size_t)y * frame.stride(), rowsize);
+	}
+
+	// time of the frame of 'slot', in any unit the application chooses
+	void SetTime(const int slot, const unsigned long long time) { m_slots[slot].time = time; }
+
+	// pass the frame of the slot from BeginWrite() to the consumer
+	void EndWrite(void)
+	{
+		m_write = (m_write + 1) % m_slots.size();
+		m_head.store(m_head.load(std::memory_order_relaxed) + 1);
+	}
+
+	// copy 'frame' into the ring; false if it is dropped
+	bool Write(const CFrameView& frame, const unsigned long long time = 0)
+	{
+		int slot = BeginWrite();
+		if (slot < 0)
+			return false;
+		SetFrame(slot, frame);
+		SetTime(slot, time);
+		EndWrite();
+		return true;
+	}
+
+	//
+	// consumer
+	//
+
+	// slot of the oldest frame, or -1 when the ring is empty. the frame
+	// stays valid until EndRead().
+	int BeginRead(void) const
+	{
+		if (m_tail.load(std::memory_order_relaxed) == m_head.load(std::memory_order_acquire))
+			return -1;
+		return m_read;
+	}
+
+	// frame of 'slot'; without data if the producer wrote none
+	const CFrameView& GetView(const int slot) const { return m_slots[slot].view; }
+	unsigned long long GetTime(const int slot) const { return m_slots[slot].time; }
+
+	// give the buffer of the oldest frame back to the producer
+	void EndRead(void)
+	{
+		m_read = (m_read + 1) % m_slots.size();
+		m_tail.store(m_tail.load(std::memory_order_relaxed) + 1);
+	}
+
+private:
+	struct slot_t {
+		slot_t() : time(0) {}
+		std::vector<unsigned char> pixels;
+		CFrameView view;
+		unsigned long long time;
+	};
+
+	std::vector<slot_t> m_slots;
+	// frames written and read; only their difference matters, so they may
+	// wrap around
+	std::atomic<unsigned int> m_head;
+	std::atomic<unsigned int> m_tail;
+	std::atomic<unsigned int> m_dropped;
+	std::atomic<unsigned int> m_overruns;
+	int m_write; // slot of the next frame written; producer only
+	int m_read; // slot of the next frame read; consumer only
+	bool m_full; // the last frame was dropped; producer only
+};
+
+} // namespace slib
@@ -0,0 +1,97 @@
+//
+// This file is part of ofxActiveScan.
+//
+// captured pattern sequence stored pixel-major, in blocks of BLOCK pixels:
+// the 16-bit samples of all frames of a block are adjacent, frame by
+// frame, so a decoder that visits each pixel once reads every cache line
+// of the block once, instead of one line from every frame.
+//
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include "Field.h"
+#include "FrameView.h"
+
+namespace slib
+{
+
+class CFrameStack
+{
+public:
+	enum { BLOCK = 8 }; // pixels per block
+
+	CFrameStack() : m_nframes(0), m_nblocks(0) { m_size[0] = m_size[1] = 0; }
+
+	CFrameStack(const CVector<2,int>& size, const int nframes) { Initialize(size, nframes); }
+
+	void Initialize(const CVector<2,int>& size, const int nframes)
+	{
+		m_size = size;
+		m_nframes = nframes;
+		m_nblocks = (size[0] + BLOCK - 1) / BLOCK;
+		m_data.assign((size_t)m_nblocks * BLOCK * size[1] * nframes, 0);
+		m_max.assign(nframes, 0);
+	}
+
+	const CVector<2,int>& size(void) const { return m_size; }
+	int size(const int i) const { return m_size[i]; }
+	int GetNumFrames(void) const { return m_nframes; }
+
+	// samples of the block starting at (x,y), where x is a multiple of
+	// BLOCK. frame 't' of pixel x+i is at block(x,y)[t*BLOCK+i].
+	const unsigned short *block(const int x, const int y) const
+	{
+		return &m_data[((size_t)y * m_nblocks + x / BLOCK) * m_nframes * BLOCK];
+	}
+
+	unsigned short sample(const int x, const int y, const int t) const
+	{
+		return block(x - x % BLOCK, y)[t * BLOCK + x % BLOCK];
+	}
+
+	// maximum sample of frame 't'
+	unsigned short GetMax(const int t) const { return m_max[t]; }
+
+	// store intensities in [0,1] of a float image or a CFrameView as
+	// frame 't', quantized to 16 bits
+	template <typename image_t>
+	void SetFrame(const int t, const image_t& image)
+	{
+		const int w = m_size[0];
+		std::vector<float> buffer(w);
+		unsigned short m = 0;
+		for (int y = 0; y < m_size[1]; y++) {
+			const float *src = GetRow(image, y, &buffer[0]);
+			for (int x = 0; x < w; x += BLOCK) {
+				unsigned short *dst = &m_data[((size_t)y * m_nblocks + x / BLOCK) * m_nframes * BLOCK + t * BLOCK];
+				for (int i = 0; i < BLOCK && x + i < w; i++) {
+					float v = std::min(std::max(src[x + i], 0.0f), 1.0f);
+					dst[i] = (unsigned short)(v * 65535 + 0.5f);
+					m = std::max(m, dst[i]);
+				}
+			}
+		}
+		m_max[t] = m;
+	}
+
+	// frame 't' as a float image in [0,1]
+	void GetFrame(const int t, Field<2,float>& image) const
+	{
+		image.Initialize(m_size);
+		for (int y = 0; y < m_size[1]; y++)
+			for (int x = 0; x < m_size[0]; x++)
+				image.cell(x, y) = sample(x, y, t) * (1.0f / 65535);
+	}
+
+private:
+	CVector<2,int> m_size;
+	int m_nframes;
+	int m_nblocks; // blocks per row
+	std::vector<unsigned short> m_data;
+	std::vector<unsigned short> m_max;
+};
+
+} // namespace slib
@@ -0,0 +1,184 @@
+//
+// This file is part of ofxActiveScan.
+//
+// non-owning view of a camera frame in its native 8- or 16-bit layout.
+// decoding kernels read frames row by row through GetRow(), so integer
+// frames are converted one cache-resident row at a time instead of being
+// copied into a float image first.
+//
+
+#pragma once
+
+#include <algorithm>
+
+#include "Field.h"
+
+namespace slib
+{
+
+class CFrameView
+{
+public:
+	CFrameView() : m_data(0), m_depth(8), m_channels(1), m_stride(0) { m_size[0] = m_size[1] = 0; }
+
+	// 'channels' is 1 (gray), 3 (RGB) or 4 (RGBA); 'stride' is the row
+	// pitch in bytes, 0 for tightly packed rows.
+	CFrameView(const unsigned char *data, const int width, const int height, const int channels = 1, const int stride = 0)
+		: m_data(data), m_depth(8), m_channels(channels), m_stride(stride ? stride : width * channels)
+	{
+		m_size[0] = width; m_size[1] = height;
+	}
+
+	CFrameView(const unsigned short *data, const int width, const int height, const int channels = 1, const int stride = 0)
+		: m_data(reinterpret_cast<const unsigned char *>(data)), m_depth(16), m_channels(channels), m_stride(stride ? stride : width * channels * 2)
+	{
+		m_size[0] = width; m_size[1] = height;
+	}
+
+	const unsigned char *data(void) const { return m_data; }
+	const CVector<2,int>& size(void) const { return m_size; }
+	int size(const int i) const { return m_size[i]; }
+	int depth(void) const { return m_depth; }
+	int channels(void) const { return m_channels; }
+	int stride(void) const { return m_stride; }
+
+	// intensity of row 'y' normalized to [0,1].
+	// color pixels use the brightest channel, as ofColor::getBrightness().
+	void GetRow(const int y, float *dst) const
+	{
+		GetRow(y, 0, m_size[0], dst);
+	}
+
+	// convert pixels [x0,x1) of row 'y' into dst[x0] to dst[x1-1]
+	void GetRow(const int y, const int x0, const int x1, float *dst) const
+	{
+		const unsigned char *row = m_data + (size_t)y * m_stride;
+		if (m_depth == 8)
+			convert_row(row, x0, x1, 1.f / 255, dst);
+		else
+			convert_row(reinterpret_cast<const unsigned short *>(row), x0, x1, 1.f / 65535, dst);
+	}
+
+	// channel 'c' of pixels [x0,x1) of row 'y' into dst[x0] to dst[x1-1].
+	// gray frames give their intensity for every channel.
+	void GetRow(const int y, const int x0, const int x1, const int c, float *dst) const
+	{
+		const unsigned char *row = m_data + (size_t)y * m_stride;
+		if (m_depth == 8)
+			convert_channel(row, x0, x1, c, 1.f / 255, dst);
+		else
+			convert_channel(reinterpret_cast<const unsigned short *>(row), x0, x1, c, 1.f / 65535, dst);
+	}
+
+	// maximum intensity normalized to [0,1], computed on the integer data
+	float max(void) const
+	{
+		return max(0, m_size[1]);
+	}
+
+	// maximum intensity in rows [y0,y1)
+	float max(const int y0, const int y1) const
+	{
+		unsigned int maxval = 0;
+		for (int y = y0; y < y1; y++)
+			maxval = std::max(maxval, max_row(y, 0, m_size[0]));
+		return maxval * (m_depth == 8 ? 1.f / 255 : 1.f / 65535);
+	}
+
+	// maximum intensity of pixels [x0,x1) of row 'y'
+	float GetRowMax(const int y, const int x0, const int x1) const
+	{
+		return max_row(y, x0, x1) * (m_depth == 8 ? 1.f / 255 : 1.f / 65535);
+	}
+
+private:
+	template <typename T>
+	void convert_row(const T *src, const int x0, const int x1, const float scale, float *dst) const
+	{
+		switch (m_channels) {
+		case 1:
+			for (int x = x0; x < x1; x++)
+				dst[x] = src[x] * scale;
+			break;
+		default:
+			src += x0 * m_channels;
+			for (int x = x0; x < x1; x++, src += m_channels)
+				dst[x] = std::max(std::max(src[0], src[1]), src[2]) * scale;
+			break;
+		}
+	}
+
+	template <typename T>
+	void convert_channel(const T *src, const int x0, const int x1, const int c, const float scale, float *dst) const
+	{
+		if (m_channels == 1) {
+			convert_row(src, x0, x1, scale, dst);
+			return;
+		}
+		src += x0 * m_channels + c;
+		for (int x = x0; x < x1; x++, src += m_channels)
+			dst[x] = *src * scale;
+	}
+
+	unsigned int max_row(const int y, const int x0, const int x1) const
+	{
+		const unsigned char *row = m_data + (size_t)y * m_stride;
+		if (m_depth == 8)
+			return max_row(row, x0, x1);
+		else
+			return max_row(reinterpret_cast<const unsigned short *>(row), x0, x1);
+	}
+
+	template <typename T>
+	unsigned int max_row(const T *src, const int x0, const int x1) const
+	{
+		T m = 0;
+		if (m_channels == 1) {
+			for (int x = x0; x < x1; x++)
+				m = std::max(m, src[x]);
+		} else {
+			src += x0 * m_channels;
+			for (int x = x0; x < x1; x++, src += m_channels)
+				m = std::max(m, std::max(std::max(src[0], src[1]), src[2]));
+		}
+		return m;
+	}
+
+private:
+	const unsigned char *m_data;
+	int m_depth; // bits per channel
+	int m_channels;
+	int m_stride; // in bytes
+	CVector<2,int> m_size;
+};
+
+// row access shared by float images and frame views.
+// 'buffer' holds one row and is only written when a conversion is needed.
+inline
+const float *GetRow(const Field<2,float>& image, const int y, float *)
+{
+	return image.ptr() + (size_t)y * image.size(0);
+}
+
+inline
+const float *GetRow(const CFrameView& image, const int y, float *buffer)
+{
+	image.GetRow(y, buffer);
+	return buffer;
+}
+
+// only pixels [x0,x1) of the returned row are valid
+inline
+const float *GetRow(const Field<2,float>& image, const int y, const int, const int, float *)
+{
+	return image.ptr() + (size_t)y * image.size(0);
+}
+
+inline
+const float *GetRow(const CFrameView& image, const int y, const int x0, const int x1, float *buffer)
+{
+	image.GetRow(y, x0, x1, buffer);
+	return buffer;
+}
+
+} // namespace slib
@@ -89,6 +89,24 @@ public:
 			return true;
 	}
 
+	// the value of a key that may be missing, or 'value' if it is
+	int GetInt(const std::string& section, const std::string& key, const int value) const {
+		return HasKey(section,key) ? GetInt(section,key) : value;
+	}
+
+	double GetFloat(const std::string& section, const std::string& key, const double value) const {
+		return HasKey(section,key) ? GetFloat(section,key) : value;
+	}
+
+	bool GetBool(const std::string& section, const std::string& key, const bool value) const {
+		return HasKey(section,key) ? GetBool(section,key) : value;
+	}
+
+	bool HasKey(const std::string& section, const std::string& key) const {
+		section_list::const_iterator it = m_data.find(section);
+		return it != m_data.end() && it->second.count(key) > 0;
+	}
+
 	const std::string& GetString(const std::string& section, const std::string& key) const {
 		section_list::const_iterator it1 = m_data.find(section);
 		if (it1 == m_data.end())
@@ -0,0 +1,148 @@
+//
+// This file is part of ofxActiveScan.
+//
+// region of an image stored as runs of pixels [x0,x1) per row, so that
+// loops over a sparse region skip the pixels outside it.
+//
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include "Field.h"
+
+namespace slib
+{
+
+class CRowSpans
+{
+public:
+	struct span_t {
+		int x0, x1;
+	};
+	typedef std::vector<span_t> row_t;
+
+	CRowSpans() { m_size[0] = m_size[1] = 0; }
+
+	// the whole image
+	void Initialize(const CVector<2,int>& size)
+	{
+		m_size = size;
+		span_t all = { 0, size[0] };
+		m_rows.assign(size[1], row_t(size[0] > 0 ? 1 : 0, all));
+	}
+
+	const CVector<2,int>& size(void) const { return m_size; }
+	int size(const int i) const { return m_size[i]; }
+
+	const row_t& row(const int y) const { return m_rows[y]; }
+
+	// replace row 'y' with the runs of pixels where inside(x) is true
+	template <typename predicate_t>
+	void SetRow(const int y, predicate_t inside)
+	{
+		row_t& r = m_rows[y];
+		r.clear();
+		for (int x = 0; x < m_size[0]; ) {
+			for (; x < m_size[0] && !inside(x); x++);
+			if (x == m_size[0])
+				break;
+			span_t s;
+			s.x0 = x;
+			for (; x < m_size[0] && inside(x); x++);
+			s.x1 = x;
+			r.push_back(s);
+		}
+	}
+
+	// close holes narrower than 'gap' and grow the region by 'margin'
+	// pixels in both directions
+	void Grow(const int gap, const int margin)
+	{
+		for (int y = 0; y < m_size[1]; y++) {
+			row_t& r = m_rows[y];
+			for (size_t i = 0; i < r.size(); i++) {
+				r[i].x0 = std::max(0, r[i].x0 - margin);
+				r[i].x1 = std::min(m_size[0], r[i].x1 + margin);
+			}
+			merge(r, gap);
+		}
+
+		std::vector<row_t> rows(m_size[1]);
+		for (int y = 0; y < m_size[1]; y++) {
+			int y0 = std::max(0, y - margin), y1 = std::min(m_size[1], y + margin + 1);
+			for (int i = y0; i < y1; i++)
+				rows[y].insert(rows[y].end(), m_rows[i].begin(), m_rows[i].end());
+			std::sort(rows[y].begin(), rows[y].end(), less_x0);
+			merge(rows[y], 0);
+		}
+		m_rows.swap(rows);
+	}
+
+	// keep only the pixels that are also in 'spans'
+	void Intersect(const CRowSpans& spans)
+	{
+		for (int y = 0; y < m_size[1]; y++) {
+			const row_t& a = m_rows[y];
+			const row_t& b = spans.row(y);
+			row_t r;
+			for (size_t i = 0, j = 0; i < a.size() && j < b.size(); ) {
+				span_t s = { std::max(a[i].x0, b[j].x0), std::min(a[i].x1, b[j].x1) };
+				if (s.x0 < s.x1)
+					r.push_back(s);
+				if (a[i].x1 < b[j].x1)
+					i++;
+				else
+					j++;
+			}
+			m_rows[y].swap(r);
+		}
+	}
+
+	int GetNumPixels(void) const
+	{
+		int n = 0;
+		for (int y = 0; y < m_size[1]; y++)
+			for (size_t i = 0; i < m_rows[y].size(); i++)
+				n += m_rows[y][i].x1 - m_rows[y][i].x0;
+		return n;
+	}
+
+	// 1 inside the region and 0 outside
+	void GetMask(Field<2,float>& mask) const
+	{
+		mask.Initialize(m_size);
+		mask.Clear(0);
+		for (int y = 0; y < m_size[1]; y++)
+			for (size_t i = 0; i < m_rows[y].size(); i++)
+				std::fill(mask.ptr() + y * m_size[0] + m_rows[y][i].x0, mask.ptr() + y * m_size[0] + m_rows[y][i].x1, 1.0f);
+	}
+
+private:
+	static bool less_x0(const span_t& a, const span_t& b)
+	{
+		return a.x0 < b.x0;
+	}
+
+	// merge sorted spans that overlap or are closer than 'gap'
+	static void merge(row_t& r, const int gap)
+	{
+		if (r.empty())
+			return;
+		size_t n = 0;
+		for (size_t i = 1; i < r.size(); i++) {
+			if (r[i].x0 <= r[n].x1 + gap)
+				r[n].x1 = std::max(r[n].x1, r[i].x1);
+			else
+				r[++n] = r[i];
+		}
+		r.resize(n + 1);
+	}
+
+private:
+	CVector<2,int> m_size;
+	std::vector<row_t> m_rows;
+};
+
+} // namespace slib
@@ -0,0 +1,135 @@
+//
+// This file is part of ofxActiveScan.
+//
+// SIMD instruction set selection for the decoding kernels.
+// AVX2 is used when the compiler targets it (e.g. -mavx2), otherwise SSE2.
+// define SLIB_NO_SIMD to force the scalar code path.
+//
+
+#pragma once
+
+#if !defined(SLIB_NO_SIMD)
+#if defined(__AVX2__)
+#define SLIB_SIMD_AVX2
+#define SLIB_SIMD_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SLIB_SIMD_SSE2
+#endif
+#endif
+
+#if defined(SLIB_SIMD_AVX2)
+#include <immintrin.h>
+#elif defined(SLIB_SIMD_SSE2)
+#include <emmintrin.h>
+#endif
+
+#if defined(SLIB_SIMD_SSE2)
+
+namespace slib
+{
+namespace simd
+{
+
+// thin wrappers so that a kernel is written once for the widest available 
+// register. comparisons return all-ones lanes where true.
+#if defined(SLIB_SIMD_AVX2)
+typedef __m256 vfloat;
+typedef __m256i vint;
+const int width = 8;
+
+inline vfloat load(const float *p) { return _mm256_loadu_ps(p); }
+inline void store(float *p, const vfloat a) { _mm256_storeu_ps(p, a); }
+inline vfloat set1(const float a) { return _mm256_set1_ps(a); }
+inline vfloat add(const vfloat a, const vfloat b) { return _mm256_add_ps(a, b); }
+inline vfloat sub(const vfloat a, const vfloat b) { return _mm256_sub_ps(a, b); }
+inline vfloat mul(const vfloat a, const vfloat b) { return _mm256_mul_ps(a, b); }
+inline vfloat div(const vfloat a, const vfloat b) { return _mm256_div_ps(a, b); }
+inline vfloat min(const vfloat a, const vfloat b) { return _mm256_min_ps(a, b); }
+inline vfloat max(const vfloat a, const vfloat b) { return _mm256_max_ps(a, b); }
+inline vfloat sqrt(const vfloat a) { return _mm256_sqrt_ps(a); }
+inline vfloat cmplt(const vfloat a, const vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline vfloat cmpgt(const vfloat a, const vfloat b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+inline vfloat cmpeq(const vfloat a, const vfloat b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+inline vfloat bit_and(const vfloat a, const vfloat b) { return _mm256_and_ps(a, b); }
+inline vfloat bit_or(const vfloat a, const vfloat b) { return _mm256_or_ps(a, b); }
+inline vfloat bit_andnot(const vfloat a, const vfloat b) { return _mm256_andnot_ps(a, b); }
+inline vfloat bit_xor(const vfloat a, const vfloat b) { return _mm256_xor_ps(a, b); }
+
+inline vint loadi(const void *p) { return _mm256_loadu_si256((const __m256i *)p); }
+inline void storei(void *p, const vint a) { _mm256_storeu_si256((__m256i *)p, a); }
+inline vint set1i(const int a) { return _mm256_set1_epi32(a); }
+inline vint addi(const vint a, const vint b) { return _mm256_add_epi32(a, b); }
+inline vint subi(const vint a, const vint b) { return _mm256_sub_epi32(a, b); }
+inline vint andi(const vint a, const vint b) { return _mm256_and_si256(a, b); }
+inline vint ori(const vint a, const vint b) { return _mm256_or_si256(a, b); }
+inline vint xori(const vint a, const vint b) { return _mm256_xor_si256(a, b); }
+inline vint srli(const vint a, const int n) { return _mm256_srli_epi32(a, n); }
+inline vfloat to_float(const vint a) { return _mm256_cvtepi32_ps(a); }
+inline vint to_int(const vfloat a) { return _mm256_cvttps_epi32(a); }
+inline vfloat floor(const vfloat a) { return _mm256_floor_ps(a); }
+inline vint as_int(const vfloat a) { return _mm256_castps_si256(a); }
+inline vfloat as_float(const vint a) { return _mm256_castsi256_ps(a); }
+// 'width' unsigned 16-bit values converted to float
+inline vfloat load_u16(const unsigned short *p) { return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)p))); }
+#else
+typedef __m128 vfloat;
+typedef __m128i vint;
+const int width = 4;
+
+inline vfloat load(const float *p) { return _mm_loadu_ps(p); }
+inline void store(float *p, const vfloat a) { _mm_storeu_ps(p, a); }
+inline vfloat set1(const float a) { return _mm_set1_ps(a); }
+inline vfloat add(const vfloat a, const vfloat b) { return _mm_add_ps(a, b); }
+inline vfloat sub(const vfloat a, const vfloat b) { return _mm_sub_ps(a, b); }
+inline vfloat mul(const vfloat a, const vfloat b) { return _mm_mul_ps(a, b); }
+inline vfloat div(const vfloat a, const vfloat b) { return _mm_div_ps(a, b); }
+inline vfloat min(const vfloat a, const vfloat b) { return _mm_min_ps(a, b); }
+inline vfloat max(const vfloat a, const vfloat b) { return _mm_max_ps(a, b); }
+inline vfloat sqrt(const vfloat a) { return _mm_sqrt_ps(a); }
+inline vfloat cmplt(const vfloat a, const vfloat b) { return _mm_cmplt_ps(a, b); }
+inline vfloat cmpgt(const vfloat a, const vfloat b) { return _mm_cmpgt_ps(a, b); }
+inline vfloat cmpeq(const vfloat a, const vfloat b) { return _mm_cmpeq_ps(a, b); }
+inline vfloat bit_and(const vfloat a, const vfloat b) { return _mm_and_ps(a, b); }
+inline vfloat bit_or(const vfloat a, const vfloat b) { return _mm_or_ps(a, b); }
+inline vfloat bit_andnot(const vfloat a, const vfloat b) { return _mm_andnot_ps(a, b); }
+inline vfloat bit_xor(const vfloat a, const vfloat b) { return _mm_xor_ps(a, b); }
+
+inline vint loadi(const void *p) { return _mm_loadu_si128((const __m128i *)p); }
+inline void storei(void *p, const vint a) { _mm_storeu_si128((__m128i *)p, a); }
+inline vint set1i(const int a) { return _mm_set1_epi32(a); }
+inline vint addi(const vint a, const vint b) { return _mm_add_epi32(a, b); }
+inline vint subi(const vint a, const vint b) { return _mm_sub_epi32(a, b); }
+inline vint andi(const vint a, const vint b) { return _mm_and_si128(a, b); }
+inline vint ori(const vint a, const vint b) { return _mm_or_si128(a, b); }
+inline vint xori(const vint a, const vint b) { return _mm_xor_si128(a, b); }
+inline vint srli(const vint a, const int n) { return _mm_srli_epi32(a, n); }
+inline vfloat to_float(const vint a) { return _mm_cvtepi32_ps(a); }
+inline vint to_int(const vfloat a) { return _mm_cvttps_epi32(a); }
+// toward minus infinity; SSE2 has no rounding, so |a| must be below 2^31
+inline vfloat floor(const vfloat a)
+{
+	vfloat t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a));
+	return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a), _mm_set1_ps(1.0f)));
+}
+inline vint as_int(const vfloat a) { return _mm_castps_si128(a); }
+inline vfloat as_float(const vint a) { return _mm_castsi128_ps(a); }
+inline vfloat load_u16(const unsigned short *p) { return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)p), _mm_setzero_si128())); }
+#endif
+
+inline vfloat zero() { return set1(0.0f); }
+
+// mask ? a : b
+inline vfloat select(const vfloat mask, const vfloat a, const vfloat b) 
+{
+	return bit_or(bit_and(mask, a), bit_andnot(mask, b));
+}
+
+inline vfloat abs(const vfloat a) 
+{
+	return bit_andnot(set1(-0.0f), a);
+}
+
+} // namespace simd
+} // namespace slib
+
+#endif // SLIB_SIMD_SSE2
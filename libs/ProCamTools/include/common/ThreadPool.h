@@ -0,0 +1,176 @@
+//
+// This file is part of ofxActiveScan.
+//
+// Thread pool shared by the decoding stages.
+// ParallelFor() splits a range of rows into tiles. The calling thread
+// works on the tiles too, so it may be called from inside a task.
+//
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <exception>
+#include <algorithm>
+
+namespace slib
+{
+
+class CThreadPool
+{
+public:
+	// 'nthreads' counts the calling thread; 0 uses all hardware threads
+	// and 1 runs everything on the calling thread.
+	explicit CThreadPool(int nthreads = 0) : m_stop(false)
+	{
+		if (nthreads <= 0)
+			nthreads = std::max(1u, std::thread::hardware_concurrency());
+		for (int i = 1; i < nthreads; i++)
+			m_workers.push_back(std::thread(&CThreadPool::run, this));
+	}
+
+	~CThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_cond.notify_all();
+		for (size_t i = 0; i < m_workers.size(); i++)
+			m_workers[i].join();
+	}
+
+	int GetNumThreads() const
+	{
+		return m_workers.size() + 1;
+	}
+
+	// run 'task' on a worker thread
+	std::future<void> Submit(const std::function<void()>& task)
+	{
+		std::shared_ptr<std::packaged_task<void()> > job(new std::packaged_task<void()>(task));
+		std::future<void> result = job->get_future();
+		if (m_workers.empty()) {
+			(*job)();
+			return result;
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_queue.push_back([job]() { (*job)(); });
+		}
+		m_cond.notify_one();
+		return result;
+	}
+
+	// call func(y0, y1) for tiles of [begin, end) and wait for all of them.
+	// the first exception thrown by 'func' is rethrown here once every
+	// tile is done; the tiles not started by then are skipped.
+	template <typename function_t>
+	void ParallelFor(const int begin, const int end, function_t func, const int tile = 0)
+	{
+		if (end <= begin)
+			return;
+		const int nthreads = GetNumThreads();
+		int step = tile > 0 ? tile : std::max(1, (end - begin + 4 * nthreads - 1) / (4 * nthreads));
+		int ntiles = (end - begin + step - 1) / step;
+		if (ntiles == 1 || nthreads == 1) {
+			func(begin, end);
+			return;
+		}
+
+		// helpers that start after all tiles are taken return without
+		// calling 'func', so only the job itself needs to outlive this call
+		std::shared_ptr<job_t> job(new job_t(func, begin, end, step));
+		int nhelpers = std::min(ntiles, nthreads) - 1;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			for (int i = 0; i < nhelpers; i++)
+				m_queue.push_back([job]() { job->work(); });
+		}
+		m_cond.notify_all();
+
+		job->work();
+		std::unique_lock<std::mutex> lock(job->mutex);
+		job->cond.wait(lock, [&job]() { return job->done == job->ntiles; });
+		if (job->error)
+			std::rethrow_exception(job->error);
+	}
+
+	// pool shared by all decoders
+	static CThreadPool& GetShared()
+	{
+		static CThreadPool pool;
+		return pool;
+	}
+
+private:
+	struct job_t
+	{
+		std::function<void(int,int)> body;
+		const int begin, end, step, ntiles;
+		std::atomic<int> next, done;
+		std::mutex mutex;
+		std::condition_variable cond;
+		std::exception_ptr error; // first exception of 'body', under 'mutex'
+		std::atomic<bool> failed;
+
+		job_t(const std::function<void(int,int)>& f, int b, int e, int s) 
+			: body(f), begin(b), end(e), step(s), ntiles((e - b + s - 1) / s), next(0), done(0), failed(false) {}
+
+		void work()
+		{
+			for (int i = next++; i < ntiles; i = next++) {
+				int y0 = begin + i * step;
+				if (!failed) {
+					try {
+						body(y0, std::min(end, y0 + step));
+					} catch (...) {
+						std::lock_guard<std::mutex> lock(mutex);
+						if (!error)
+							error = std::current_exception();
+						failed = true;
+					}
+				}
+				// a tile that threw still counts, or the caller would wait forever
+				if (++done == ntiles) {
+					std::lock_guard<std::mutex> lock(mutex);
+					cond.notify_all();
+				}
+			}
+		}
+	};
+
+	void run()
+	{
+		for (;;) {
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cond.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+				if (m_stop && m_queue.empty())
+					return;
+				task = m_queue.front();
+				m_queue.pop_front();
+			}
+			task();
+		}
+	}
+
+	CThreadPool(const CThreadPool&);
+	CThreadPool& operator=(const CThreadPool&);
+
+	std::vector<std::thread> m_workers;
+	std::deque<std::function<void()> > m_queue;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	bool m_stop;
+};
+
+} // namespace slib
@@ -0,0 +1,142 @@
+//
+// This file is part of ofxActiveScan.
+//
+// histograms of the intensities in square tiles of an image. a high
+// percentile of each tile stands for the intensity of a lit pattern there,
+// so that thresholds follow the illumination across the image and a few
+// specular pixels do not raise them. the histogram of the whole image
+// tells how far the exposure is from filling the range of the camera.
+//
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include "Field.h"
+
+namespace slib
+{
+
+class CTileHistogram
+{
+public:
+	enum { BINS = 64 }; // bins over [0,1]
+
+	CTileHistogram() : m_tile(0), m_level(1) { m_size[0] = m_size[1] = 0; m_ntiles[0] = m_ntiles[1] = 0; }
+
+	// empty histograms of the tiles of 'tile' pixels of an image of 'size'
+	void Initialize(const CVector<2,int>& size, const int tile = 32)
+	{
+		m_size = size;
+		m_tile = tile;
+		m_ntiles[0] = (size[0] + tile - 1) / tile;
+		m_ntiles[1] = (size[1] + tile - 1) / tile;
+		m_counts.assign((size_t)m_ntiles[0] * m_ntiles[1] * BINS, 0);
+		m_levels.assign((size_t)m_ntiles[0] * m_ntiles[1], 1.0f);
+		m_total.assign(BINS, 0);
+		m_level = 1;
+	}
+
+	bool IsValid(void) const { return m_tile > 0; }
+
+	int GetTileSize(void) const { return m_tile; }
+	int GetNumTiles(const int i) const { return m_ntiles[i]; }
+
+	// add the intensities in [0,1] of pixels [x0,x1) of row 'y', where
+	// values[x] is pixel x. rows of different rows of tiles may be added
+	// concurrently.
+	void AddRow(const int y, const int x0, const int x1, const float *values)
+	{
+		unsigned int *h = &m_counts[(size_t)(y / m_tile) * m_ntiles[0] * BINS];
+		for (int x = x0; x < x1; x++) {
+			int b = std::min(std::max((int)(values[x] * BINS), 0), BINS - 1);
+			h[(x / m_tile) * BINS + b]++;
+		}
+	}
+
+	// set the level of each tile to the 'percentile' of its intensities,
+	// and at least 'floor' times the level of the whole image, the highest
+	// level of a tile, so that tiles the patterns do not reach keep a
+	// threshold above the noise. a bright spot has to cover more than the
+	// rest of the percentile of a tile to raise the level of the image.
+	void Finish(const float percentile, const float floor)
+	{
+		const int ntiles = m_ntiles[0] * m_ntiles[1];
+		m_total.assign(BINS, 0);
+		m_level = 0;
+		for (int t = 0; t < ntiles; t++) {
+			const unsigned int *h = &m_counts[(size_t)t * BINS];
+			for (int b = 0; b < BINS; b++)
+				m_total[b] += h[b];
+			m_levels[t] = get_percentile(h, percentile);
+			m_level = std::max(m_level, m_levels[t]);
+		}
+		for (int t = 0; t < ntiles; t++)
+			m_levels[t] = std::max(m_levels[t], floor * m_level);
+	}
+
+	// level of the tile of pixel (x,y), and of the whole image
+	float GetLevel(const int x, const int y) const { return m_levels[(y / m_tile) * m_ntiles[0] + x / m_tile]; }
+	float GetLevel(void) const { return m_level; }
+
+	// call func(x0, x1, level) for the part of [x0,x1) in each tile of row 'y'
+	template <typename function_t>
+	void ForEachTile(const int y, const int x0, const int x1, function_t func) const
+	{
+		const float *levels = &m_levels[(y / m_tile) * m_ntiles[0]];
+		for (int x = x0; x < x1; ) {
+			int end = std::min((x / m_tile + 1) * m_tile, x1);
+			func(x, end, levels[x / m_tile]);
+			x = end;
+		}
+	}
+
+	// fraction of the pixels in the top bin
+	float GetSaturation(void) const
+	{
+		double total = 0;
+		for (int b = 0; b < BINS; b++)
+			total += m_total[b];
+		return total ? (float)(m_total[BINS - 1] / total) : 0.0f;
+	}
+
+	// factor of the exposure that brings the level of the image to
+	// 'target'. while more than 'maxsaturated' of the pixels saturate the
+	// level is unknown, and the exposure is halved.
+	float GetExposureScale(const float target = 0.9f, const float maxsaturated = 0.01f) const
+	{
+		if (GetSaturation() > maxsaturated)
+			return 0.5f;
+		return m_level > 0 ? target / m_level : 1.0f;
+	}
+
+private:
+	// center of the bin where the cumulative count reaches 'percentile'
+	float get_percentile(const unsigned int *h, const float percentile) const
+	{
+		double total = 0;
+		for (int b = 0; b < BINS; b++)
+			total += h[b];
+		if (total == 0)
+			return 0;
+		double count = 0;
+		for (int b = 0; b < BINS; b++) {
+			count += h[b];
+			if (count >= percentile * total)
+				return (b + 0.5f) / BINS;
+		}
+		return 1;
+	}
+
+private:
+	CVector<2,int> m_size;
+	int m_tile; // pixels per side of a tile
+	int m_ntiles[2];
+	std::vector<unsigned int> m_counts; // BINS per tile, row by row
+	std::vector<float> m_levels; // per tile
+	std::vector<double> m_total; // whole image
+	float m_level; // whole image
+};
+
+} // namespace slib
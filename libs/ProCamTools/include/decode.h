@@ -7,132 +7,266 @@
 
 #pragma once
 
+#include <mutex>
+#include <atomic>
+#include <memory>
+
 #include "Field.h"
+#include "FrameView.h"
+#include "RowSpans.h"
+#include "FrameStack.h"
 #include "ImageBmpIO.h"
 #include "ImageBase.h"
+#include "ThreadPool.h"
 
 #include "Options.h"
-#include "GrayCode.h"
+#include "Patterns.h"
+#include "ColorMultiplex.h"
 
 class CDecode
 {
 public:
-	CDecode(const options_t& o) : m_options(o), stage(HORIZONTAL_GRAY) {}
-	CDecode(const std::string& filename) : stage(HORIZONTAL_GRAY) { m_options.load(filename); }
+	CDecode(const options_t& o) : m_options(o) { reset(); }
+	CDecode(const std::string& filename) { m_options.load(filename); reset(); }
+	
+	// decoding stages run in row tiles on 'pool' (the shared pool by default)
+	void SetThreadPool(slib::CThreadPool& pool) {
+		m_pool = &pool;
+		for( int direction = 0 ; direction < 2 ; direction++ )
+			m_decoder[direction]->SetThreadPool(pool);
+	}
+	
+	// the pattern family, with its frame count and decode cost
+	const CPatternFamily& GetFamily(void) const {
+		return *m_family;
+	}
+	
+	int GetNumImages(void) const {
+		return get_num_images(0) + get_num_images(1);
+	}
+	
+	int GetNumImages(int direction) const {
+		return get_num_images(direction);
+	}
+	
+	// number of camera frames of the sequence; with options_t::color each
+	// frame carries three images
+	int GetNumFrames(void) const {
+		return m_options.color ? GetNumColorFrames(GetNumImages()) : GetNumImages();
+	}
+	
+	// unmix color frames with the crosstalk measured for the installation
+	// (no crosstalk by default)
+	void SetCrosstalk(const CColorCrosstalk& crosstalk) {
+		m_unmix = crosstalk.GetUnmixing();
+	}
+	
+	// number of images of 'direction' added so far
+	int GetNumDecoded(int direction) const {
+		return m_count[direction];
+	}
 	
 	// add from filepath
 	void AddImage(const std::string& s) {
+		if (m_options.color) {
+			add_color_file(s);
+			return;
+		}
 		slib::Field<2, float> image;
 		slib::image::Read(image, s);
 		
 		AddImage(image);
 	}
 	
+	// images are folded into the decoded maps as they arrive, 
+	// so only the first image of a complementary pair is kept
 	void AddImage(const slib::Field<2, float>& image) {
-		if( stage != FINISHED )
-			images.push_back(image);
-		
-		if( stage == HORIZONTAL_GRAY ) {
-			int nbits = m_options.get_num_bits(0);
-			if( images.size() == 2*nbits ) {
-				decode_gray(images,0);
-				generate_mask(0);
-				
-				stage = HORIZONTAL_SINE;
-				images.clear();
-			}
-		} else if( stage == HORIZONTAL_SINE ) {
-			if( images.size() == m_options.num_fringes ) {
-				decode_phase(images,0);
-				if (m_options.debug)
-					dump_images(0);
-				convert_reliable_map(0);
-				
-				stage = VERTICAL_GRAY;
-				images.clear();
-			}
-		} else if( stage == VERTICAL_GRAY ) {
-			int nbits = m_options.get_num_bits(1);
-			if( images.size() == 2*nbits ) {
-				decode_gray(images,1);
-				generate_mask(1);
-				
-				stage = VERTICAL_SINE;
-				images.clear();
-			}
-		} else if( stage == VERTICAL_SINE ) {
-			if( images.size() == m_options.num_fringes ) {
-				decode_phase(images,1);
-				if (m_options.debug)
-					dump_images(1);
-				convert_reliable_map(1);
-				stage == DECODING;
-				images.clear();
-			}
-		}
-		
-		if( stage == DECODING ) {
-			// merge masks and reliable maps
-			if (m_options.horizontal && m_options.vertical)
-			{
-				for (int y = 0; y < m_mask[1].size(1); y++)
-				{
-					for (int x = 0; x < m_mask[1].size(0); x++)
-					{
-						if (!m_mask[1].cell(x, y))
-							m_mask[0].cell(x, y) = 0;
-						m_phase_error[0].cell(x,y) = std::min(m_phase_error[0].cell(x,y),m_phase_error[1].cell(x,y));
-					}
-				}
-			}
-			
-			stage = FINISHED;
-		}
+		if (m_options.color)
+			throw std::runtime_error("color sequences need color frames");
+		add_next(image);
+	}
+	
+	// add a camera frame without converting it to a float image.
+	// the frame is only read during the call.
+	// color frames of a color sequence are unmixed into their images,
+	// which are decoded as a frame stack once the last frame is added.
+	void AddImage(const slib::CFrameView& frame) {
+		if (m_options.color)
+			add_color(frame);
+		else
+			add_next(frame);
+	}
+	
+	// add an 8- or 16-bit gray (1), RGB (3) or RGBA (4) channel frame.
+	// 'stride' is the row pitch in bytes, 0 for packed rows.
+	void AddImage(const unsigned char *data, int width, int height, int channels = 1, int stride = 0) {
+		AddImage(slib::CFrameView(data, width, height, channels, stride));
+	}
+	
+	void AddImage(const unsigned short *data, int width, int height, int channels = 1, int stride = 0) {
+		AddImage(slib::CFrameView(data, width, height, channels, stride));
+	}
+	
+	// add the next image of 'direction'.
+	// images of one direction must be added in order, but the two
+	// directions may be decoded on different threads at the same time.
+	void AddImage(int direction, const slib::Field<2, float>& image) {
+		add(direction, image);
+	}
+	
+	void AddImage(int direction, const slib::CFrameView& frame) {
+		add(direction, frame);
 	}
 	
+	// decode a whole sequence; horizontal and vertical run concurrently
 	void Decode(const std::vector<std::string>& files) {
+		int nh = get_num_images(0);
+		if( nh > 0 && nh < (int)files.size() && (int)files.size() == GetNumImages() ) {
+			std::future<void> horizontal = m_pool->Submit([this, &files, nh]() {
+				for( int i = 0 ; i < nh ; i++ )
+					add_file(0, files[i]);
+			});
+			for( int i = nh ; i < (int)files.size() ; i++ )
+				add_file(1, files[i]);
+			horizontal.get();
+			return;
+		}
+		
 		std::vector<std::string>::const_iterator it = files.begin();
 		for( ; it < files.end() ; it++ ) {
 			AddImage(*it);
 		}
 	}
 	
+	// decode a whole sequence stored pixel-major, in the order of CEncode.
+	// both directions of a row are decoded together, so the samples of
+	// each pixel are read once for all stages. families that cannot decode
+	// row by row get the frames one by one.
+	void Decode(const slib::CFrameStack& stack) {
+		for( int direction = 0 ; direction < 2 ; direction++ ) {
+			if( get_num_images(direction) > 0 && !m_decoder[direction]->CanDecodeStack() ) {
+				slib::Field<2,float> image;
+				for( int t = 0 ; t < stack.GetNumFrames() ; t++ ) {
+					stack.GetFrame(t, image);
+					add_next(image);
+				}
+				return;
+			}
+		}
+
+		if( m_options.min_decodable > 0 ) {
+			for( int direction = 0 ; direction < 2 ; direction++ )
+				if( get_num_images(direction) > 0 )
+					check_stack_quality(stack, direction);
+			if( m_rejected )
+				return;
+		}
+
+		for( int direction = 0 ; direction < 2 ; direction++ )
+			if( get_num_images(direction) > 0 )
+				m_decoder[direction]->BeginStack(stack, direction ? get_num_images(0) : 0);
+		m_pool->ParallelFor(0, stack.size(1), [&](int y0, int y1) {
+			for( int y = y0 ; y < y1 ; y++ )
+				for( int direction = 0 ; direction < 2 ; direction++ )
+					if( get_num_images(direction) > 0 )
+						m_decoder[direction]->DecodeStack(stack, direction ? get_num_images(0) : 0, y, y + 1);
+		});
+		for( int direction = 0 ; direction < 2 ; direction++ ) {
+			if( get_num_images(direction) == 0 )
+				continue;
+			m_decoder[direction]->EndStack();
+			m_count[direction] = get_num_images(direction);
+			finish();
+		}
+	}
+	
 	bool IsFinished() const {
-		return stage == FINISHED;
+		return m_finished;
+	}
+	
+	// with options_t::min_decodable, a scan whose first complementary pair
+	// decodes fewer pixels is rejected as soon as the pair is added, and the
+	// images that follow are ignored, so that a dark scene or a misaimed
+	// projector is caught two frames into the capture. Decode() of a stack
+	// checks the pair before decoding, and color frames with the frame that
+	// completes it.
+	bool IsRejected() const {
+		return m_rejected;
+	}
+	
+	// early quality of the first direction; see CPatternDecoder::GetQuality()
+	bool GetQuality(float& contrast, float& decodable) const {
+		return m_decoder[m_options.horizontal ? 0 : 1]->GetQuality(contrast, decodable);
+	}
+	
+	// with options_t::adaptive_threshold, the factor of the camera exposure
+	// that would bring the patterns of the first direction close to the
+	// top of the range without saturating them, as measured on its first
+	// images; 1 otherwise
+	float GetExposureScale(void) const {
+		const slib::CTileHistogram& levels = m_decoder[m_options.horizontal ? 0 : 1]->GetLevels();
+		return levels.IsValid() ? levels.GetExposureScale() : 1.0f;
 	}
 	
 	const slib::Field<2,float>& GetMap(int direction) const {
-		return m_phase_map[direction];
+		return m_decoder[direction]->GetMap();
 	}
 	
 	const slib::Field<2,float>& GetHorizontal() const {
-		return m_phase_map[0];
+		return m_decoder[0]->GetMap();
 	}
 	
 	const slib::Field<2,float>& GetVertical() const {
-		return m_phase_map[1];
+		return m_decoder[1]->GetMap();
+	}
+
+	// modulation amplitude of the sinusoidal patterns
+	const slib::Field<2,float>& GetAmplitude(int direction) const {
+		return m_decoder[direction]->GetAmplitude();
+	}
+
+	// projector pixels per camera pixel along 'direction', measured on the
+	// decoded map within the lit region. the map is compared modulo the
+	// fringe period, where the phase holds even if the finest gray-code
+	// planes were not resolved, so options_t::set_footprint() can leave
+	// them out of the next scans.
+	float GetFootprint(int direction) const {
+		slib::Field<2,float> region;
+		GetRegion(direction).GetMask(region);
+		return slib::EstimateFootprint(GetMap(direction), region, (float)m_options.get_fringe_period());
 	}
 
 	void WriteMap(int direction, const std::string& filename) const {
-		m_phase_map[direction].Write(filename);
+		m_decoder[direction]->GetMap().Write(filename);
 	}
 
 	const slib::Field<2,float>& GetMask(void) const { 
-		if (m_options.horizontal) 
-			return m_mask[0];
-		else
-			return m_mask[1];
+		return m_decoder[m_options.horizontal ? 0 : 1]->GetMask();
 	}
 
 	void WriteMask(const std::string& filename) const {
 		slib::image::Write(GetMask(),filename);
 	}
 
+	// pixels lit by the projector, detected from the first gray-code image.
+	// every stage after the first image only visits this region.
+	const slib::CRowSpans& GetRegion(int direction) const {
+		return m_decoder[direction]->GetRegion();
+	}
+
+	// 1 where both directions are lit
+	void GetRegionMask(slib::Field<2,float>& mask) const {
+		if (m_options.horizontal && m_options.vertical) {
+			slib::CRowSpans region = GetRegion(0);
+			region.Intersect(GetRegion(1));
+			region.GetMask(mask);
+		} else {
+			GetRegion(m_options.horizontal ? 0 : 1).GetMask(mask);
+		}
+	}
+
 	const slib::Field<2,float>& GetReliable(void) const { 
-		if (m_options.horizontal) 
-			return m_phase_error[0];
-		else
-			return m_phase_error[1];
+		return m_decoder[m_options.horizontal ? 0 : 1]->GetReliable();
 	}
 
 	void WriteReliable(const std::string& filename) const {
@@ -140,113 +274,158 @@ public:
 	}
 
 private:
-	void convert_reliable_map(int direction)
+	void reset()
 	{
-		float maxerror = 2.0/m_options.num_fringes;
-		slib::Field<2,float>& reliable = m_phase_error[direction];
-		for (int y=0; y<reliable.size(1); y++) {
-			for (int x=0; x<reliable.size(0); x++) {
-				if (reliable.cell(x,y) < maxerror && 
-					m_gray_error[direction].cell(x,y) < 2) {
-					reliable.cell(x,y) = 1;
-				} else {
-					reliable.cell(x,y) = 0;
-				}
-			}
-		}
+		m_pool = &slib::CThreadPool::GetShared();
+		m_family.reset(CreatePatternFamily(m_options));
+		for( int direction = 0 ; direction < 2 ; direction++ )
+			m_decoder[direction].reset(m_family->CreateDecoder(direction));
+		m_count[0] = m_count[1] = 0;
+		m_ndone = 0;
+		m_finished = false;
+		m_rejected = false;
+		for( int i = 0 ; i < 3 ; i++ )
+			for( int j = 0 ; j < 3 ; j++ )
+				m_unmix(i,j) = i == j;
+		m_ncolor = 0;
 	}
 
-	void decode_gray(const std::vector<slib::Field<2,float> >& images, int direction)
+	int get_num_images(int direction) const
 	{
-		int nbits = m_options.get_num_bits(direction);
-		std::vector<slib::Field<2,float> > diff(nbits);
-		for (int bit = 0; bit<nbits; bit++)
-		{
-			float maxval = std::max(images[2*bit].max(), images[2*bit+1].max());
-			diff[nbits-1-bit] = images[2*bit]-images[2*bit+1];
-
-			if (m_gray_error[direction].size() != images[0].size()) { 
-				m_gray_error[direction].Initialize(images[0].size());
-				m_gray_error[direction].Clear(0);
-			}
-
-			// count error
-			float threshold = m_options.intensity_threshold * maxval;
-			CountGraycodeUncertainty(diff[nbits-1-bit], threshold, m_gray_error[direction]);
-		}
+		if (direction ? !m_options.vertical : !m_options.horizontal)
+			return 0;
+		return m_family->GetNumImages(direction);
+	}
 
-		// decode graycode
-		DecodeGrayCodeImages(diff, m_gray_map[direction]);
+	template <typename image_t>
+	void add_next(const image_t& image)
+	{
+		if( m_count[0] < get_num_images(0) )
+			add(0, image);
+		else
+			add(1, image);
 	}
 
-	void decode_phase(const std::vector<slib::Field<2,float> >& images, int direction)
+	template <typename image_t>
+	void add(int direction, const image_t& image)
 	{
-		DecodePhaseCodeImages(images, m_phase_map[direction]);
+		int index = m_count[direction];
+		if( index >= get_num_images(direction) || m_rejected )
+			return;
+
+		m_decoder[direction]->AddImage(index, image);
+		if( m_options.min_decodable > 0 && index < 2 )
+			check_quality(direction);
+
+		if( ++m_count[direction] == get_num_images(direction) )
+			finish();
+	}
 
-		UnwrapPhase(m_phase_map[direction], m_options.fringe_interval*m_options.num_fringes, m_gray_map[direction], m_phase_map[direction], m_phase_error[direction]);
+	void check_quality(int direction)
+	{
+		float contrast, decodable;
+		if( m_decoder[direction]->GetQuality(contrast, decodable) &&
+			decodable < m_options.min_decodable )
+			m_rejected = true;
 	}
 
-	void dump_images(int direction) const
+	// the quality of the first pair of 'direction' in 'stack', unless it
+	// was measured before
+	void check_stack_quality(const slib::CFrameStack& stack, int direction)
 	{
-		char *suffix = (char *)(direction ? "v" : "h");
-		float s = 1.0/m_gray_map[direction].size(0);
-		WriteCorrespondenceMap(m_gray_map[direction], m_mask[direction], slib::format("gray-%s.bmp", suffix), s);
-		WriteCorrespondenceMap(m_phase_map[direction], m_mask[direction], slib::format("phase-%s.bmp", suffix), s);
-		ExportCorrespondencePlot(m_gray_map[direction], m_mask[direction], slib::format("gray-%s.dat", suffix));
-		ExportCorrespondencePlot(m_phase_map[direction], m_mask[direction], slib::format("phase-%s.dat", suffix));
-
-		slib::Field<2,float> err;
-		slib::Field<2,slib::CVector<3,float> > rgb;
-
-		err=m_gray_error[direction];
-		err /= m_options.get_num_bits(direction);
-		slib::image::ConvertToJetMap(err,rgb);
-		apply_mask(m_mask[direction],rgb);
-		slib::image::Write(rgb,slib::format("gray-error-%s.bmp", suffix));
-
-		err=m_phase_error[direction];
-		err /= 0.5;
-		slib::image::ConvertToJetMap(err,rgb);
-		apply_mask(m_mask[direction],rgb);
-		slib::image::Write(rgb,slib::format("phase-error-%s.bmp", suffix));
-	}
-
-	void apply_mask(const slib::Field<2,float>& mask, slib::Field<2,slib::CVector<3,float> >& img) const 
+		float contrast, decodable;
+		if( !m_decoder[direction]->GetQuality(contrast, decodable) )
+			m_decoder[direction]->MeasureQuality(stack, direction ? get_num_images(0) : 0);
+		check_quality(direction);
+	}
+
+	void add_file(int direction, const std::string& s)
 	{
-		for (int y=0; y<mask.size(1); y++) 
-			for (int x=0; x<mask.size(0); x++) 
-				if (mask.cell(x,y) < 1)
-					img.cell(x,y) = slib::make_vector(0,0,0);		
+		slib::Field<2, float> image;
+		slib::image::Read(image, s);
+		AddImage(direction, image);
 	}
 
-	void generate_mask(int direction)
+	// unmix a color frame into the stack of images
+	void add_color(const slib::CFrameView& frame)
 	{
-		int nbits = m_options.get_num_bits(direction);
-		m_mask[direction].Initialize(m_gray_error[direction].size());
-		for (int y=0; y<m_gray_error[direction].size(1); y++) {
-			for (int x=0; x<m_gray_error[direction].size(0); x++)
-				if (m_gray_error[direction].cell(x,y) < nbits-1)
-					m_mask[direction].cell(x,y) = 1;
-				else
-					m_mask[direction].cell(x,y) = 0;
+		int nimages = GetNumImages();
+		if( m_ncolor >= GetNumFrames() || m_rejected )
+			return;
+		if( m_ncolor == 0 )
+			m_planes.Initialize(frame.size(), nimages);
+
+		for( int k = 0 ; k < 3 ; k++ )
+			m_plane[k].Initialize(frame.size());
+		m_pool->ParallelFor(0, frame.size(1), [&](int y0, int y1) {
+			UnmixColorFrame(frame, m_unmix, m_plane, y0, y1);
+		});
+		for( int k = 0 ; k < 3 ; k++ ) {
+			int j = GetColorPlane(nimages, m_ncolor, k);
+			if( j >= 0 )
+				m_planes.SetFrame(j, m_plane[k]);
+		}
+
+		// the first pair of a direction is checked with the frame that
+		// completes it, as the stream checks its second image
+		if( m_options.min_decodable > 0 ) {
+			for( int direction = 0 ; direction < 2 ; direction++ ) {
+				int first = direction ? get_num_images(0) : 0;
+				int nframes = GetNumFrames();
+				if( get_num_images(direction) > 1 &&
+					std::max(first % nframes, (first + 1) % nframes) == m_ncolor )
+					check_stack_quality(m_planes, direction);
+			}
+			if( m_rejected ) {
+				m_planes = slib::CFrameStack();
+				return;
+			}
+		}
+
+		if( ++m_ncolor == GetNumFrames() ) {
+			for( int k = 0 ; k < 3 ; k++ )
+				m_plane[k].Invalidate();
+			Decode(m_planes);
+			m_planes = slib::CFrameStack();
 		}
 	}
 
+	void add_color_file(const std::string& s)
+	{
+		slib::Field<2, slib::CVector<3,float> > image;
+		slib::image::Read(image, s, 1.0f);
+		std::vector<unsigned char> pixels(3 * image.size(0) * image.size(1));
+		for( size_t i = 0 ; i < pixels.size() ; i++ )
+			pixels[i] = (unsigned char)(image.ptr()[i / 3][i % 3] * 255 + 0.5f);
+		add_color(slib::CFrameView(&pixels[0], image.size(0), image.size(1), 3));
+	}
+
+	// merge masks and reliable maps once all directions are decoded
+	void finish()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (++m_ndone < (m_options.horizontal ? 1 : 0) + (m_options.vertical ? 1 : 0))
+			return;
+
+		if (m_options.horizontal && m_options.vertical)
+			m_decoder[0]->Merge(*m_decoder[1]);
+
+		m_finished = true;
+	}
+
 private:
 	options_t m_options;
-	slib::Field<2,float> m_gray_map[2];
-	slib::Field<2,float> m_phase_map[2];
-	slib::Field<2,int> m_gray_error[2];
-	slib::Field<2,float> m_phase_error[2]; // also used as reliable mask
-	slib::Field<2,float> m_mask[2];
-	std::vector<slib::Field<2,float> > images;
-	enum STAGE {
-		HORIZONTAL_GRAY = 0,
-		HORIZONTAL_SINE = 1,
-		VERTICAL_GRAY = 2,
-		VERTICAL_SINE = 3,
-		DECODING = 4,
-		FINISHED = 5
-	};
-	STAGE stage;
+	slib::CThreadPool *m_pool;
+	std::unique_ptr<CPatternFamily> m_family;
+	std::unique_ptr<CPatternDecoder> m_decoder[2];
+	int m_count[2]; // number of images added
+	int m_ndone; // number of decoded directions
+	std::atomic<bool> m_finished;
+	std::atomic<bool> m_rejected;
+	std::mutex m_mutex;
+	// color multiplexing
+	slib::CMatrix<3,3,float> m_unmix;
+	slib::Field<2,float> m_plane[3]; // images of the current frame
+	slib::CFrameStack m_planes; // images of the frames added so far
+	int m_ncolor; // number of color frames added
 };
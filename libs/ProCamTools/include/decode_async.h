@@ -0,0 +1,298 @@
+//
+// This file is part of ofxActiveScan.
+//
+// CDecode front end that decodes on its own worker thread.
+// AddImage() copies the frame into a lock-free ring of buffers and returns
+// at once, so the thread that displays the patterns never waits for
+// decoding; the worker decodes the frames in place. images must be added
+// from a single thread.
+//
+
+#pragma once
+
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+#include "Field.h"
+#include "FrameView.h"
+#include "FrameRing.h"
+
+#include "Options.h"
+#include "decode.h"
+
+class CAsyncDecode
+{
+public:
+	enum { STAGE_GRAY = CPatternFamily::STAGE_CODE, STAGE_PHASE = CPatternFamily::STAGE_PHASE, STAGE_FINISHED };
+
+	struct progress_t {
+		int direction; // direction being decoded
+		int stage;
+		int done; // images decoded in the stage
+		int total; // images of the stage
+		int queued; // images waiting in the queue
+	};
+
+	// seconds the decoded images spent in a stage
+	struct stage_time_t {
+		stage_time_t() : count(0), total(0), max(0) {}
+		void add(double t) { count++; total += t; max = std::max(max, t); }
+		double mean() const { return count ? total / count : 0; }
+		int count;
+		double total, max;
+	};
+
+	struct timing_t {
+		timing_t() : finished(0) {}
+		stage_time_t queue; // from AddImage() to the worker
+		stage_time_t decode; // in the decoder
+		unsigned long long finished; // GetTime() once the maps were decoded, or 0
+	};
+
+	typedef std::function<void(const CDecode&)> callback_t;
+	typedef std::function<void(const progress_t&)> progress_callback_t;
+
+	// at most 'capacity' images wait in the queue. with a frame size the
+	// buffers are allocated at once, otherwise with the first frames.
+	CAsyncDecode(const options_t& o, int capacity = 4, int width = 0, int height = 0, int channels = 1, int depth = 8)
+		: m_options(o), m_decoder(o), m_images(std::max(1, capacity)), m_slot(-1), m_waiting(false), m_stop(false)
+	{
+		m_ring.Initialize(capacity, width, height, channels, depth);
+		m_result = m_promise.get_future().share();
+		update_progress(0);
+		m_worker = std::thread(&CAsyncDecode::run, this);
+	}
+
+	~CAsyncDecode()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_cond.notify_all();
+		m_worker.join();
+	}
+
+	int GetNumImages(void) const {
+		return m_decoder.GetNumImages();
+	}
+
+	// queue a copy of the next image.
+	// returns false without blocking if the queue is full.
+	bool AddImage(const slib::CFrameView& frame) {
+		if (!m_ring.Write(frame, GetTime()))
+			return false;
+		wake();
+		return true;
+	}
+
+	bool AddImage(const unsigned char *data, int width, int height, int channels = 1, int stride = 0) {
+		return AddImage(slib::CFrameView(data, width, height, channels, stride));
+	}
+
+	bool AddImage(const unsigned short *data, int width, int height, int channels = 1, int stride = 0) {
+		return AddImage(slib::CFrameView(data, width, height, channels, stride));
+	}
+
+	bool AddImage(const slib::Field<2,float>& image) {
+		int slot = m_ring.BeginWrite();
+		if (slot < 0)
+			return false;
+		m_images[slot] = image;
+		m_ring.SetTime(slot, GetTime());
+		m_ring.EndWrite();
+		wake();
+		return true;
+	}
+
+	// a buffer in the queue for the next image, for a source that writes
+	// the frame itself instead of having it copied; returns 0 if the queue
+	// is full. the frame is decoded once it is filled and passed with
+	// CommitImage().
+	unsigned char *BeginImage(int width, int height, int channels = 1, int depth = 8) {
+		m_slot = m_ring.BeginWrite();
+		if (m_slot < 0)
+			return 0;
+		return m_ring.GetBuffer(m_slot, width, height, channels, depth);
+	}
+
+	// false without a buffer from BeginImage() to pass
+	bool CommitImage() {
+		if (m_slot < 0)
+			return false;
+		m_ring.SetTime(m_slot, GetTime());
+		m_slot = -1;
+		m_ring.EndWrite();
+		wake();
+		return true;
+	}
+
+	// images refused because the queue was full, and the times it filled up
+	unsigned int GetDropped() const {
+		return m_ring.GetDropped();
+	}
+
+	unsigned int GetOverruns() const {
+		return m_ring.GetOverruns();
+	}
+
+	bool IsFinished() const {
+		return m_decoder.IsFinished();
+	}
+
+	// see CDecode::IsRejected(); queued images are dropped
+	bool IsRejected() const {
+		return m_decoder.IsRejected();
+	}
+
+	// becomes ready with the decoder once all maps are decoded, or once
+	// the scan is rejected
+	std::shared_future<const CDecode *> GetResult() const {
+		return m_result;
+	}
+
+	// the decoder; its maps may only be read after IsFinished()
+	const CDecode& GetDecoder() const {
+		return m_decoder;
+	}
+
+	// pool of the decoding stages, see CDecode::SetThreadPool(); call it
+	// before the first image, the worker reads it once images arrive
+	void SetThreadPool(slib::CThreadPool& pool) {
+		m_decoder.SetThreadPool(pool);
+	}
+
+	timing_t GetTiming() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_timing;
+	}
+
+	// microseconds on a steady clock, the unit of timing_t::finished
+	static unsigned long long GetTime() {
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	progress_t GetProgress() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		progress_t p = m_progress;
+		p.queued = m_ring.GetCount();
+		return p;
+	}
+
+	// callbacks are called on the worker thread; the callback once all
+	// maps are decoded or the scan is rejected
+	void SetCallback(const callback_t& callback) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_callback = callback;
+	}
+
+	void SetProgressCallback(const progress_callback_t& callback) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_progress_callback = callback;
+	}
+
+private:
+	// wake the worker if it waits for images
+	void wake()
+	{
+		if (m_waiting) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_cond.notify_one();
+		}
+	}
+
+	void run()
+	{
+		while (!m_stop) {
+			int slot = m_ring.BeginRead();
+			if (slot < 0) {
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_waiting = true;
+				m_cond.wait(lock, [this]() { return m_stop || !m_ring.IsEmpty(); });
+				m_waiting = false;
+				continue;
+			}
+
+			bool finished = m_decoder.IsFinished() || m_decoder.IsRejected();
+			unsigned long long queued = m_ring.GetTime(slot), start = GetTime(), end = start;
+			if (!finished) {
+				const slib::CFrameView& view = m_ring.GetView(slot);
+				if (view.data())
+					m_decoder.AddImage(view);
+				else
+					m_decoder.AddImage(m_images[slot]);
+				end = GetTime();
+			}
+			m_images[slot].Invalidate();
+			m_ring.EndRead();
+
+			callback_t callback;
+			progress_callback_t progress_callback;
+			progress_t progress;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				update_progress(m_ring.GetCount());
+				if (!finished) {
+					m_timing.queue.add((start - queued) * 1e-6);
+					m_timing.decode.add((end - start) * 1e-6);
+					if (m_decoder.IsFinished() || m_decoder.IsRejected())
+						m_timing.finished = end;
+				}
+				progress = m_progress;
+				callback = m_callback;
+				progress_callback = m_progress_callback;
+			}
+			if (finished)
+				continue;
+			if (progress_callback)
+				progress_callback(progress);
+			if (m_decoder.IsFinished() || m_decoder.IsRejected()) {
+				if (callback)
+					callback(m_decoder);
+				m_promise.set_value(&m_decoder);
+			}
+		}
+	}
+
+	void update_progress(int queued)
+	{
+		progress_t& p = m_progress;
+		p.queued = queued;
+		p.stage = STAGE_FINISHED;
+		p.done = p.total = 0;
+		for (int direction = 0; direction < 2; direction++) {
+			int count = m_decoder.GetNumDecoded(direction);
+			if (count >= m_decoder.GetNumImages(direction))
+				continue;
+			p.direction = direction;
+			p.stage = m_decoder.GetFamily().GetStage(direction, count, p.done, p.total);
+			return;
+		}
+		p.direction = m_options.vertical ? 1 : 0;
+	}
+
+private:
+	options_t m_options;
+	CDecode m_decoder;
+	slib::CFrameRing m_ring;
+	std::vector<slib::Field<2,float> > m_images; // float images of the slots of the ring
+	int m_slot; // slot of BeginImage()
+	progress_t m_progress;
+	timing_t m_timing;
+	callback_t m_callback;
+	progress_callback_t m_progress_callback;
+	std::promise<const CDecode *> m_promise;
+	std::shared_future<const CDecode *> m_result;
+	std::atomic<bool> m_waiting; // the worker sleeps until an image is added
+	std::atomic<bool> m_stop;
+	mutable std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::thread m_worker;
+};
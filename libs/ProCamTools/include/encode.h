@@ -7,62 +7,123 @@
 
 #pragma once
 
+#include <memory>
+#include <vector>
+#include <algorithm>
+
 #include "Field.h"
 #include "ImageBmpIO.h"
 
 #include "Options.h"
-#include "GrayCode.h"
+#include "Patterns.h"
+#include "ColorMultiplex.h"
 
 class CEncode
 {
 public:
-	CEncode(const options_t& o) : m_options(o), index(0) {}
-	CEncode(const std::string& filename) : index(0) { m_options.load(filename); }
+	CEncode(const options_t& o) : m_options(o), index(0) { reset(); }
+	CEncode(const std::string& filename) : index(0) { m_options.load(filename); reset(); }
 
+	// number of projected frames; with options_t::color each frame
+	// carries three images
 	int GetNumImages(void) const { 
+		int n = GetNumPlanes();
+		return m_options.color ? GetNumColorFrames(n) : n;
+	}
+
+	// number of images of the enabled directions; options_t::color packs
+	// three into each frame
+	int GetNumPlanes(void) const {
 		int n = 0;
 		if ( m_options.horizontal) 
-			n += 2 * m_options.get_num_bits(0) + m_options.num_fringes;
+			n += m_family->GetNumImages(0);
 		if ( m_options.vertical)
-			n += 2 * m_options.get_num_bits(1) + m_options.num_fringes;
+			n += m_family->GetNumImages(1);
 		return n;
 	}
 
+	// the pattern family, with its frame count and decode cost
+	const CPatternFamily& GetFamily(void) const {
+		return *m_family;
+	}
+
 /*	void WriteImage(int id, const std::string& filename) const {
 		slib::Field<2,float> image;
 		GetImage(id,image);
 		slib::image::Write(image,filename);
 	}
 */
+	// direction of the 'id'-th image (0: horizontal, 1: vertical).
+	// 'id' counts the images of the sequence, which are the frames unless
+	// options_t::color packs them as GetColorPlane() lays them out.
+	int GetDirection(int id) const {
+		int direction;
+		locate(id, direction);
+		return direction;
+	}
+
+	// values of the 'id'-th image along x for the horizontal direction, or
+	// along y for the vertical one; the image repeats them over the rows
+	void GetProfile(int id, std::vector<unsigned char>& profile) const {
+		int direction;
+		int i = locate(id, direction);
+		m_family->GetProfile(direction, i, profile);
+	}
+
+	// the 'id'-th frame, copied from the frames of Prepare() if they are
+	// kept and generated otherwise
 	void GetImage(int id, slib::Field<2,unsigned char>& image) const {
-		image.Initialize(m_options.projector_width,m_options.projector_height);
-		if ( m_options.horizontal) {
-			if (id < m_options.get_num_bits(0)*2) {
-				get_gray(0, id, image);
-				return;
-			}
-			id-=m_options.get_num_bits(0)*2;
-			if (id < m_options.num_fringes) {
-				get_phase(0, id, image);
-				return;
-			}
-			id-=m_options.num_fringes;
-		}
-		if (m_options.vertical) {
-			if (id < m_options.get_num_bits(1)*2) {
-				get_gray(1, id, image);
-				return;
-			}
-			id-=m_options.get_num_bits(1)*2;
-			if (id < m_options.num_fringes) {
-				get_phase(1, id, image);
-				return;
-			}
-			id-=m_options.num_fringes;
-		}
-		throw std::runtime_error("invalid image id");
+		if (m_options.color)
+			throw std::runtime_error("color frames are read with GetColorImage()");
+		if (id < 0 || id >= GetNumImages())
+			throw std::runtime_error("invalid image id");
+		if (m_cache[id].size(0))
+			copy_image(m_cache[id], image);
+		else
+			get_plane(id, image);
 	}
 	
+	// the 'id'-th frame kept by Prepare(), so that showing a pattern again
+	// is a lookup
+	const slib::Field<2,unsigned char>& GetCachedImage(int id) const {
+		if (m_options.color)
+			throw std::runtime_error("color frames are read with GetColorImage()");
+		if (id < 0 || id >= GetNumImages())
+			throw std::runtime_error("invalid image id");
+		if (m_cache[id].size(0) == 0)
+			throw std::runtime_error("frames are kept by Prepare()");
+		return m_cache[id];
+	}
+
+	// 'id'-th frame with three images in its channels as GetColorPlane()
+	// lays them out. without options_t::color the image is gray.
+	void GetColorImage(int id, slib::Field<2,slib::CVector<3,unsigned char> >& image) const {
+		if (id < 0 || id >= GetNumImages())
+			throw std::runtime_error("invalid image id");
+		if (m_color_cache[id].size(0))
+			copy_image(m_color_cache[id], image);
+		else
+			get_color(id, image);
+	}
+
+	const slib::Field<2,slib::CVector<3,unsigned char> >& GetCachedColorImage(int id) const {
+		if (id < 0 || id >= GetNumImages())
+			throw std::runtime_error("invalid image id");
+		if (m_color_cache[id].size(0) == 0)
+			throw std::runtime_error("frames are kept by Prepare()");
+		return m_color_cache[id];
+	}
+
+	slib::Field<2,slib::CVector<3,unsigned char> > GetColorImage(int id) const {
+		slib::Field<2,slib::CVector<3,unsigned char> > image;
+		GetColorImage(id, image);
+		return image;
+	}
+
+	slib::Field<2,slib::CVector<3,unsigned char> > GetColorImage() const {
+		return GetColorImage(index);
+	}
+
 	slib::Field<2,unsigned char> GetImage(int id) const {
 		slib::Field<2,unsigned char> image;
 		GetImage(id, image);
@@ -70,11 +131,30 @@ public:
 	}
 	
 	slib::Field<2,unsigned char> GetImage() const {
-		slib::Field<2,unsigned char> image;
-		GetImage(index, image);
-		return image;
+		return GetImage(index);
 	}
 	
+	// generate every frame before the capture starts and keep them, so
+	// that no frame is generated while the patterns are projected. the
+	// const members may be called from several threads, but not together
+	// with Prepare() or ClearCache().
+	void Prepare(void) {
+		for (int id = 0; id < GetNumImages(); id++) {
+			if (m_options.color)
+				get_color(id, m_color_cache[id]);
+			else
+				get_plane(id, m_cache[id]);
+		}
+	}
+
+	// release the kept frames
+	void ClearCache(void) {
+		for (size_t i = 0; i < m_cache.size(); i++) {
+			m_cache[i].Invalidate();
+			m_color_cache[i].Invalidate();
+		}
+	}
+
 	bool IsFinished() const {
 		return index >= GetNumImages();
 	}
@@ -88,17 +168,71 @@ public:
 	}
 
 private:
-	void get_gray(int direction, int id, slib::Field<2,unsigned char>& image) const {
-		int level = m_options.get_num_bits(direction)  - 1 - id / 2;
-		// id%2 == 1 if complementary
-		GenerateGrayCodeImage(direction, level, image, id%2);
+	// index within its direction of the 'id'-th image
+	int locate(int id, int& direction) const {
+		if ( m_options.horizontal) {
+			if (id >= 0 && id < m_family->GetNumImages(0)) {
+				direction = 0;
+				return id;
+			}
+			id-=m_family->GetNumImages(0);
+		}
+		if (m_options.vertical) {
+			if (id >= 0 && id < m_family->GetNumImages(1)) {
+				direction = 1;
+				return id;
+			}
+		}
+		throw std::runtime_error("invalid image id");
+	}
+
+	void get_plane(int id, slib::Field<2,unsigned char>& image) const {
+		image.Initialize(m_options.projector_width,m_options.projector_height);
+		int direction;
+		int i = locate(id, direction);
+		m_family->GetImage(direction, i, image);
+	}
+
+	// channels are filled from the profiles, which vary along different
+	// axes when a frame carries both directions
+	void get_color(int id, slib::Field<2,slib::CVector<3,unsigned char> >& image) const {
+		int w = m_options.projector_width, h = m_options.projector_height;
+		image.Initialize(w, h);
+		std::vector<unsigned char> profile;
+		for (int c = 0; c < 3; c++) {
+			int j = m_options.color ? GetColorPlane(GetNumPlanes(), id, c) : id;
+			if (j < 0) {
+				for (int i = 0; i < w * h; i++)
+					image.ptr()[i][c] = 0;
+				continue;
+			}
+			int direction = GetDirection(j);
+			GetProfile(j, profile);
+			for (int y = 0; y < h; y++) {
+				slib::CVector<3,unsigned char> *dst = image.ptr() + (size_t)y * w;
+				for (int x = 0; x < w; x++)
+					dst[x][c] = profile[direction ? y : x];
+			}
+		}
+	}
+
+	template <typename T>
+	static void copy_image(const slib::Field<2,T>& src, slib::Field<2,T>& dst) {
+		dst.Initialize(src.size());
+		std::copy(src.ptr(), src.ptr() + (size_t)src.size(0) * src.size(1), dst.ptr());
 	}
 
-	void get_phase(int direction, int id, slib::Field<2,unsigned char>& image) const {
-			GeneratePhaseCodeImage(direction, m_options.num_fringes, id, image);
+	void reset() {
+		m_family.reset(CreatePatternFamily(m_options));
+		m_cache.resize(GetNumImages());
+		m_color_cache.resize(GetNumImages());
 	}
 
 private:
 	options_t m_options;
+	std::shared_ptr<const CPatternFamily> m_family;
+	// frames of Prepare(), empty until then
+	std::vector<slib::Field<2,unsigned char> > m_cache;
+	std::vector<slib::Field<2,slib::CVector<3,unsigned char> > > m_color_cache;
 	int index;
 };
@@ -0,0 +1,456 @@
+//
+// This file is part of ofxActiveScan.
+//
+// renders what the camera of a projector-camera pair sees of each pattern,
+// so that scans can be decoded, calibrated and triangulated without the
+// hardware and compared with the correspondence they should give. the
+// pair follows the model of CProCamCalibrate: the camera is at the origin
+// looking along +z, the projector extrinsic maps camera coordinates to
+// projector coordinates, and each lens has a single radial distortion
+// coefficient about its principal point, as in
+// slib::fmatrix::ApplyRadialDistortion().
+//
+// surfaces are white and Lambertian, and shadowed where a surface the
+// camera sees is closer to the projector. the projector lens blurs the
+// patterns evenly, and the camera adds ambient light and noise.
+//
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+
+#include "Field.h"
+#include "MathBase.h"
+#include "ThreadPool.h"
+#include "FundamentalMatrix.h"
+
+#include "Options.h"
+#include "encode.h"
+
+class CProCamSimulate
+{
+public:
+	struct params_t {
+		params_t() : brightness(0.8f), ambient(0.05f), gamma(1.0f), defocus(0), noise(0.01f), seed(0) {}
+		float brightness;	// intensity of a white pattern on a surface facing the projector
+		float ambient;		// intensity without the projector
+		float gamma;		// response of the projector to pattern values
+		float defocus;		// standard deviation of the blur of the projector lens, in projector pixels
+		float noise;		// standard deviation of the camera noise
+		unsigned int seed;	// of the noise
+	};
+
+	CProCamSimulate(const options_t& o) : m_options(o), m_cam_dist(0), m_pro_dist(0)
+	{
+		m_cam_int = m_pro_int = slib::make_diagonal_matrix<double>(1, 1, 1);
+		m_pro_ext = m_cam_int.AppendCols(slib::make_vector<double>(0, 0, 0));
+	}
+
+	// camera of 'width' x 'height' pixels; forgets the scene
+	void SetCamera(const int width, const int height, const slib::CMatrix<3,3,double>& intrinsic, const double distortion = 0)
+	{
+		m_cam_int = intrinsic;
+		m_cam_dist = distortion;
+		m_depth.Initialize(width, height);
+		m_depth.Clear(0);
+		m_samples.clear();
+	}
+
+	// projector of the size in the options. 'extrinsic' maps camera to
+	// projector coordinates, as CProCamCalibrate::GetProExtrinsic().
+	void SetProjector(const slib::CMatrix<3,3,double>& intrinsic, const double distortion, const slib::CMatrix<3,4,double>& extrinsic)
+	{
+		m_pro_int = intrinsic;
+		m_pro_dist = distortion;
+		m_pro_ext = extrinsic;
+		if (!m_samples.empty())
+			prepare();
+	}
+
+	const params_t& GetParams(void) const { return m_params; }
+	void SetParams(const params_t& params) { m_params = params; }
+
+	// the scene as the depth along the optical axis of the camera at each
+	// camera pixel, 0 where the camera sees nothing. set the camera and the
+	// projector first.
+	void SetDepth(const slib::Field<2,float>& depth)
+	{
+		if (depth.size(0) != m_depth.size(0) || depth.size(1) != m_depth.size(1))
+			throw std::runtime_error("depth map of another size than the camera");
+		std::copy(depth.ptr(), depth.ptr() + (size_t)depth.size(0) * depth.size(1), m_depth.ptr());
+		prepare();
+	}
+
+	// the scene as 'triangles' indexing 'vertices' in camera coordinates
+	void SetMesh(const std::vector<slib::CVector<3,double> >& vertices, const std::vector<slib::CVector<3,int> >& triangles)
+	{
+		m_depth.Clear(0);
+		for (size_t i = 0; i < triangles.size(); i++)
+			rasterize(vertices[triangles[i][0]], vertices[triangles[i][1]], vertices[triangles[i][2]]);
+		prepare();
+	}
+
+	const slib::Field<2,float>& GetDepth(void) const { return m_depth; }
+
+	// projector pixel seen at each camera pixel, and the pixels the
+	// projector lights, as CDecode::GetHorizontal(), GetVertical() and
+	// GetMask() should give them
+	void GetCorrespondence(slib::Field<2,float>& horizontal, slib::Field<2,float>& vertical, slib::Field<2,float>& mask) const
+	{
+		const int stride = m_options.projector_width + 1;
+		horizontal.Initialize(m_depth.size());
+		vertical.Initialize(m_depth.size());
+		mask.Initialize(m_depth.size());
+		for (size_t i = 0; i < m_samples.size(); i++) {
+			const sample_t& s = m_samples[i];
+			bool lit = s.index >= 0;
+			horizontal.ptr()[i] = lit ? s.index % stride + s.fx / 256.0f : 0;
+			vertical.ptr()[i] = lit ? s.index / stride + s.fy / 256.0f : 0;
+			mask.ptr()[i] = lit ? 1 : 0;
+		}
+	}
+
+	// camera image of 'pattern' in [0,1]. 'frame' selects the noise, so
+	// that a frame rendered again is the same.
+	void Render(const slib::Field<2,unsigned char>& pattern, slib::Field<2,float>& image, const int frame = 0) const
+	{
+		std::vector<std::vector<float> > planes(1);
+		linearize(pattern.ptr(), 1, pattern.size(), planes[0]);
+		image.Initialize(m_depth.size());
+		render(planes, 1, 0, image.ptr(), frame);
+	}
+
+	// into a tightly packed 8-bit frame of 'channels' channels, all alike
+	void Render(const slib::Field<2,unsigned char>& pattern, unsigned char *data, const int channels = 1, const int frame = 0) const
+	{
+		std::vector<std::vector<float> > planes(1);
+		linearize(pattern.ptr(), 1, pattern.size(), planes[0]);
+		render(planes, channels, data, 0, frame);
+	}
+
+	// a color pattern into an RGB frame; each channel of the camera sees
+	// the same channel of the projector only
+	void Render(const slib::Field<2,slib::CVector<3,unsigned char> >& pattern, unsigned char *data, const int frame = 0) const
+	{
+		std::vector<std::vector<float> > planes(3);
+		for (int c = 0; c < 3; c++)
+			linearize(&pattern.ptr()[0][c], 3, pattern.size(), planes[c]);
+		render(planes, 3, data, 0, frame);
+	}
+
+	// the 'id'-th frame of 'encoder', in RGB with options_t::color
+	void Render(const CEncode& encoder, const int id, unsigned char *data, const int channels = 1) const
+	{
+		if (m_options.color)
+			Render(encoder.GetColorImage(id), data, id);
+		else
+			Render(encoder.GetImage(id), data, channels, id);
+	}
+
+private:
+	// where a camera pixel samples the pattern: pixel 'index' of the padded
+	// pattern and the one right of and below it, weighted by 'fx' and 'fy'
+	// in 256ths; -1 where the projector does not light the pixel
+	struct sample_t {
+		sample_t() : index(-1), fx(0), fy(0), shade(0) {}
+		int index;
+		unsigned char fx, fy;
+		unsigned short shade; // cosine of the projector ray and the surface normal, of 65535
+	};
+
+	// point of the scene at camera pixel (x,y), false if there is none
+	bool get_point(const slib::CMatrix<3,3,double>& inverse, const int x, const int y, slib::CVector<3,double>& point) const
+	{
+		if (!m_depth.IsInside(x, y))
+			return false;
+		const float z = m_depth.cell(x, y);
+		if (!(z > 0))
+			return false;
+		slib::CVector<2,double> u;
+		slib::fmatrix::CancelRadialDistortion(m_cam_dist, get_center(m_cam_int), slib::make_vector<double>(x, y), u);
+		point = inverse * slib::make_vector<double>(u[0], u[1], 1);
+		point *= z / point[2];
+		return true;
+	}
+
+	static slib::CVector<2,double> get_center(const slib::CMatrix<3,3,double>& intrinsic)
+	{
+		return slib::make_vector<double>(intrinsic(0,2), intrinsic(1,2));
+	}
+
+	// projector pixel lighting 'point' and its depth along the projector
+	// axis; false if the point is behind the projector or the distortion
+	// folds over
+	bool project(const slib::CVector<3,double>& point, slib::CVector<2,double>& pixel, double& depth) const
+	{
+		slib::CVector<3,double> p;
+		for (int r = 0; r < 3; r++)
+			p[r] = m_pro_ext(r,0) * point[0] + m_pro_ext(r,1) * point[1] + m_pro_ext(r,2) * point[2] + m_pro_ext(r,3);
+		if (p[2] <= 0)
+			return false;
+		depth = p[2];
+		p = m_pro_int * p;
+		slib::fmatrix::ApplyRadialDistortion(m_pro_dist, get_center(m_pro_int), slib::make_vector<double>(p[0] / p[2], p[1] / p[2]), pixel);
+		return pixel[0] == pixel[0] && pixel[1] == pixel[1];
+	}
+
+	// which projector pixel lights each camera pixel, and how much
+	void prepare(void)
+	{
+		const int w = m_depth.size(0), h = m_depth.size(1);
+		const int pw = m_options.projector_width, ph = m_options.projector_height;
+		const slib::CMatrix<3,3,double> inverse = slib::inverse_of(m_cam_int);
+		slib::CVector<3,double> center;
+		for (int c = 0; c < 3; c++)
+			center[c] = -(m_pro_ext(0,c) * m_pro_ext(0,3) + m_pro_ext(1,c) * m_pro_ext(1,3) + m_pro_ext(2,c) * m_pro_ext(2,3));
+
+		// projector pixel and depth of each point
+		m_samples.assign((size_t)w * h, sample_t());
+		std::vector<float> pixels((size_t)w * h * 2), depths((size_t)w * h, 0.f);
+		slib::CThreadPool::GetShared().ParallelFor(0, h, [&](int y0, int y1) {
+			for (int y = y0; y < y1; y++) {
+				for (int x = 0; x < w; x++) {
+					size_t i = (size_t)y * w + x;
+					slib::CVector<3,double> p, dx[2], dy[2];
+					slib::CVector<2,double> pixel;
+					double depth;
+					if (!get_point(inverse, x, y, p) || !project(p, pixel, depth))
+						continue;
+					if (!(pixel[0] >= 0 && pixel[0] <= pw - 1 && pixel[1] >= 0 && pixel[1] <= ph - 1))
+						continue;
+
+					// normal from the neighbors on either side that exist
+					bool hx[2] = { get_point(inverse, x - 1, y, dx[0]), get_point(inverse, x + 1, y, dx[1]) };
+					bool hy[2] = { get_point(inverse, x, y - 1, dy[0]), get_point(inverse, x, y + 1, dy[1]) };
+					if (!(hx[0] || hx[1]) || !(hy[0] || hy[1]))
+						continue;
+					slib::CVector<3,double> tx = (hx[1] ? dx[1] : p) - (hx[0] ? dx[0] : p);
+					slib::CVector<3,double> ty = (hy[1] ? dy[1] : p) - (hy[0] ? dy[0] : p);
+					slib::CVector<3,double> normal = cross(tx, ty);
+					if (dot(normal, p) > 0)
+						normal = -normal;
+					slib::CVector<3,double> ray = center - p;
+					double shade = dot(normal, ray) / sqrt(dot(normal, normal) * dot(ray, ray));
+					if (!(shade > 0))
+						continue;
+
+					pixels[2 * i] = (float)pixel[0];
+					pixels[2 * i + 1] = (float)pixel[1];
+					depths[i] = (float)depth;
+					m_samples[i].shade = (unsigned short)std::min(shade * 65535 + 0.5, 65535.0);
+				}
+			}
+		});
+
+		// nearest point along each projector ray
+		std::vector<float> nearest((size_t)pw * ph, 0.f);
+		for (size_t i = 0; i < depths.size(); i++) {
+			if (!depths[i])
+				continue;
+			float& z = nearest[(size_t)(pixels[2 * i + 1] + 0.5f) * pw + (int)(pixels[2 * i] + 0.5f)];
+			if (!z || depths[i] < z)
+				z = depths[i];
+		}
+
+		// points farther than the nearest are in its shadow. points of one
+		// surface landing on the same projector pixel differ a little.
+		const float bias = 1.02f;
+		slib::CThreadPool::GetShared().ParallelFor(0, h, [&](int y0, int y1) {
+			for (size_t i = (size_t)y0 * w; i < (size_t)y1 * w; i++) {
+				if (!depths[i])
+					continue;
+				float px = pixels[2 * i], py = pixels[2 * i + 1];
+				if (depths[i] > bias * nearest[(size_t)(py + 0.5f) * pw + (int)(px + 0.5f)])
+					continue;
+				int x0 = std::min((int)px, pw - 1), y0 = std::min((int)py, ph - 1);
+				sample_t& s = m_samples[i];
+				s.index = y0 * (pw + 1) + x0;
+				s.fx = (unsigned char)std::min((int)((px - x0) * 256 + 0.5f), 255);
+				s.fy = (unsigned char)std::min((int)((py - y0) * 256 + 0.5f), 255);
+			}
+		});
+		for (size_t i = 0; i < m_samples.size(); i++)
+			if (m_samples[i].index < 0)
+				m_samples[i].shade = 0;
+	}
+
+	// keep the nearest depth of the triangle at each camera pixel
+	void rasterize(const slib::CVector<3,double>& v0, const slib::CVector<3,double>& v1, const slib::CVector<3,double>& v2)
+	{
+		const slib::CVector<3,double> *v[3] = { &v0, &v1, &v2 };
+		slib::CVector<2,double> a[3];
+		double bounds[4] = { 1e30, 1e30, -1e30, -1e30 };
+		for (int k = 0; k < 3; k++) {
+			if ((*v[k])[2] <= 0)
+				return;
+			a[k] = to_image(*v[k]);
+
+			// the distortion bends the edges, so their middles are bounded too
+			slib::CVector<2,double> corner[2] = { a[k], to_image((*v[k] + *v[(k + 1) % 3]) * 0.5) };
+			for (int j = 0; j < 2; j++) {
+				slib::CVector<2,double> d;
+				slib::fmatrix::ApplyRadialDistortion(m_cam_dist, get_center(m_cam_int), corner[j], d);
+				if (!(d[0] == d[0] && d[1] == d[1])) {
+					bounds[0] = bounds[1] = -1e30;
+					bounds[2] = bounds[3] = 1e30;
+					continue;
+				}
+				bounds[0] = std::min(bounds[0], d[0]); bounds[1] = std::min(bounds[1], d[1]);
+				bounds[2] = std::max(bounds[2], d[0]); bounds[3] = std::max(bounds[3], d[1]);
+			}
+		}
+		const int x0 = (int)std::max(floor(bounds[0]) - 1, 0.0), y0 = (int)std::max(floor(bounds[1]) - 1, 0.0);
+		const int x1 = (int)std::min(ceil(bounds[2]) + 1, m_depth.size(0) - 1.0), y1 = (int)std::min(ceil(bounds[3]) + 1, m_depth.size(1) - 1.0);
+
+		// barycentric coordinates in the undistorted image, where the inverse
+		// depth is linear
+		const double det = (a[1][0] - a[0][0]) * (a[2][1] - a[0][1]) - (a[2][0] - a[0][0]) * (a[1][1] - a[0][1]);
+		if (!det)
+			return;
+		for (int y = y0; y <= y1; y++) {
+			for (int x = x0; x <= x1; x++) {
+				slib::CVector<2,double> u;
+				slib::fmatrix::CancelRadialDistortion(m_cam_dist, get_center(m_cam_int), slib::make_vector<double>(x, y), u);
+				double l1 = ((u[0] - a[0][0]) * (a[2][1] - a[0][1]) - (a[2][0] - a[0][0]) * (u[1] - a[0][1])) / det;
+				double l2 = ((a[1][0] - a[0][0]) * (u[1] - a[0][1]) - (u[0] - a[0][0]) * (a[1][1] - a[0][1])) / det;
+				double l0 = 1 - l1 - l2;
+				if (l0 < -1e-9 || l1 < -1e-9 || l2 < -1e-9)
+					continue;
+				float z = (float)(1 / (l0 / v0[2] + l1 / v1[2] + l2 / v2[2]));
+				float& depth = m_depth.cell(x, y);
+				if (!depth || z < depth)
+					depth = z;
+			}
+		}
+	}
+
+	// undistorted camera pixel of 'point'
+	slib::CVector<2,double> to_image(const slib::CVector<3,double>& point) const
+	{
+		slib::CVector<3,double> p = m_cam_int * point;
+		return slib::make_vector<double>(p[0] / p[2], p[1] / p[2]);
+	}
+
+	// light of the projector for a pattern of 'channels' interleaved
+	// channels, blurred by the lens, with a column and a row repeated on
+	// the right and the bottom for the samples at the edge
+	void linearize(const unsigned char *pattern, const int channels, const slib::CVector<2,int>& size, std::vector<float>& plane) const
+	{
+		const int pw = m_options.projector_width, ph = m_options.projector_height;
+		if (size[0] != pw || size[1] != ph)
+			throw std::runtime_error("pattern of another size than the projector");
+		float lut[256];
+		for (int v = 0; v < 256; v++)
+			lut[v] = pow(v / 255.0f, m_params.gamma);
+
+		const int stride = pw + 1;
+		plane.resize((size_t)stride * (ph + 1));
+		for (int y = 0; y < ph; y++)
+			for (int x = 0; x < pw; x++)
+				plane[(size_t)y * stride + x] = lut[pattern[((size_t)y * pw + x) * channels]];
+		if (m_params.defocus > 0)
+			blur(plane, pw, ph, stride);
+		for (int y = 0; y < ph; y++)
+			plane[(size_t)y * stride + pw] = plane[(size_t)y * stride + pw - 1];
+		std::copy(&plane[(size_t)(ph - 1) * stride], &plane[(size_t)ph * stride], &plane[(size_t)ph * stride]);
+	}
+
+	// separable gaussian of standard deviation 'defocus', clamped at the edges
+	void blur(std::vector<float>& plane, const int pw, const int ph, const int stride) const
+	{
+		const int radius = (int)ceil(3 * m_params.defocus);
+		std::vector<float> kernel(2 * radius + 1);
+		float sum = 0;
+		for (int k = -radius; k <= radius; k++)
+			sum += kernel[k + radius] = exp(-0.5f * k * k / (m_params.defocus * m_params.defocus));
+		for (size_t k = 0; k < kernel.size(); k++)
+			kernel[k] /= sum;
+
+		// rows padded with their edge pixels, then columns of whole rows
+		std::vector<float> tmp(plane.size());
+		slib::CThreadPool::GetShared().ParallelFor(0, ph, [&](int y0, int y1) {
+			std::vector<float> row(pw + 2 * radius);
+			for (int y = y0; y < y1; y++) {
+				const float *src = &plane[(size_t)y * stride];
+				std::fill(row.begin(), row.begin() + radius, src[0]);
+				std::copy(src, src + pw, row.begin() + radius);
+				std::fill(row.begin() + radius + pw, row.end(), src[pw - 1]);
+				float *dst = &tmp[(size_t)y * stride];
+				std::fill(dst, dst + pw, 0.f);
+				for (int k = 0; k <= 2 * radius; k++)
+					for (int x = 0; x < pw; x++)
+						dst[x] += kernel[k] * row[x + k];
+			}
+		});
+		slib::CThreadPool::GetShared().ParallelFor(0, ph, [&](int y0, int y1) {
+			for (int y = y0; y < y1; y++) {
+				float *dst = &plane[(size_t)y * stride];
+				std::fill(dst, dst + pw, 0.f);
+				for (int k = -radius; k <= radius; k++) {
+					const float *src = &tmp[(size_t)std::min(std::max(y + k, 0), ph - 1) * stride];
+					for (int x = 0; x < pw; x++)
+						dst[x] += kernel[k + radius] * src[x];
+				}
+			}
+		});
+	}
+
+	// camera pixels seeing 'planes' into 8-bit 'data' of 'channels'
+	// channels, or into float 'image'
+	void render(const std::vector<std::vector<float> >& planes, const int channels, unsigned char *data, float *image, const int frame) const
+	{
+		if (m_samples.empty())
+			throw std::runtime_error("no scene to render");
+		const int w = m_depth.size(0), h = m_depth.size(1);
+		const int stride = m_options.projector_width + 1;
+		const float gain = m_params.brightness / 65535, ambient = m_params.ambient;
+		// a sum of four uniform bytes is close to normal, with this deviation
+		const float noise = m_params.noise / 147.8f;
+
+		slib::CThreadPool::GetShared().ParallelFor(0, h, [&](int y0, int y1) {
+			for (int y = y0; y < y1; y++) {
+				unsigned int state = hash(hash(m_params.seed ^ hash(frame)) + y) | 1;
+				const sample_t *s = &m_samples[(size_t)y * w];
+				for (int x = 0; x < w; x++) {
+					for (int c = 0; c < channels; c++) {
+						float v = ambient;
+						if (s[x].index >= 0) {
+							const float *p = &planes[std::min(c, (int)planes.size() - 1)][s[x].index];
+							float tx = s[x].fx * (1 / 256.0f), ty = s[x].fy * (1 / 256.0f);
+							float top = p[0] + (p[1] - p[0]) * tx;
+							float bottom = p[stride] + (p[stride + 1] - p[stride]) * tx;
+							v += gain * s[x].shade * (top + (bottom - top) * ty);
+						}
+						state ^= state << 13; state ^= state >> 17; state ^= state << 5;
+						v += noise * ((int)(state & 255) + (int)((state >> 8) & 255) + (int)((state >> 16) & 255) + (int)(state >> 24) - 510);
+						v = std::min(std::max(v, 0.0f), 1.0f);
+						if (data)
+							data[((size_t)y * w + x) * channels + c] = (unsigned char)(v * 255 + 0.5f);
+						else
+							image[(size_t)y * w + x] = v;
+					}
+				}
+			}
+		});
+	}
+
+	static unsigned int hash(unsigned int x)
+	{
+		x ^= x >> 16; x *= 0x7feb352d;
+		x ^= x >> 15; x *= 0x846ca68b;
+		x ^= x >> 16;
+		return x;
+	}
+
+private:
+	options_t m_options;
+	params_t m_params;
+	slib::CMatrix<3,3,double> m_cam_int, m_pro_int;
+	slib::CMatrix<3,4,double> m_pro_ext;
+	double m_cam_dist, m_pro_dist;
+	slib::Field<2,float> m_depth;
+	std::vector<sample_t> m_samples; // of each camera pixel, empty without a scene
+};
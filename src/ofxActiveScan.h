@@ -28,6 +28,7 @@
 #include "ofxActiveScanTypes.h"
 #include "ofxActiveScanUtils.h"
 #include "ofxActiveScanTransform.h"
+#include "ofxActiveScanScheduler.h"
 
 #include "Field.h"
 #include "ImageBmpIO.h"
@@ -37,6 +38,8 @@
 #include "LeastSquare.h"
 #include "encode.h"
 #include "decode.h"
+#include "decode_async.h"
+#include "PatternSequence.h"
 #include "calibrate.h"
 #include "triangulate.h"
 #include "FundamentalMatrix.h"
@@ -0,0 +1,278 @@
+/*
+    This file is part of ofxActiveScan.
+
+    ofxActiveScan is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ofxActiveScan is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ofxActiveScan.  If not, see <http://www.gnu.org/licenses/>.
+
+    Naoto Hieda <micuat@gmail.com> 2013
+ */
+
+#include "ofxActiveScanScheduler.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace ofxActiveScan {
+
+// a flash must raise the mean intensity by this much to be seen
+static const float minFlash = 0.02f;
+
+CaptureScheduler::CaptureScheduler()
+: numPatterns(0), probes(1), state(IDLE), scanAfterProbe(false),
+display(DISPLAY_BLACK), capture(-1),
+latency(0), hold(1), period(0), lastTime(0), hasTime(false),
+probeCount(0), flashing(false), probeFrames(0), base(0), flash(0),
+first(0), frame(0), next(0), restarts(0),
+minChange(0.1f), confidence(0), checkNext(true) {
+}
+
+void CaptureScheduler::setup(int numPatterns, int probes) {
+	this->numPatterns = numPatterns;
+	this->probes = std::max(probes, 1);
+	stop();
+}
+
+void CaptureScheduler::start() {
+	if( !isCalibrated() ) {
+		probe(true);
+		return;
+	}
+	state = SCANNING;
+	next = 0;
+	restarts = 0;
+	change.Initialize();
+	checkNext = true;
+	restart(0);
+}
+
+void CaptureScheduler::probe(bool scan) {
+	state = PROBING;
+	scanAfterProbe = scan;
+	latency = 0;
+	hold = 1;
+	flash = 0;
+	intervals.clear();
+	probeCount = 0;
+	flashing = false;
+	probeFrames = 0;
+	samples.clear();
+	display = DISPLAY_BLACK;
+	capture = -1;
+	hasTime = false;
+}
+
+void CaptureScheduler::stop() {
+	state = IDLE;
+	display = DISPLAY_BLACK;
+	capture = -1;
+	hasTime = false;
+}
+
+void CaptureScheduler::setLatency(int latency, int hold) {
+	this->latency = std::max(latency, 1);
+	this->hold = std::max(hold, 1);
+	flash = 0;
+}
+
+int CaptureScheduler::getScanFrames() const {
+	return latency + (numPatterns - 1) * hold + 1;
+}
+
+void CaptureScheduler::update(const FrameView& frame, unsigned long long time) {
+	// only the probe looks at the whole frame
+	update(state == PROBING ? getBrightness(frame) : 0.f, time);
+	if( capture >= 0 ) {
+		check(frame);
+	}
+}
+
+void CaptureScheduler::update(float brightness, unsigned long long time) {
+	// frames the camera delivered since the last call, counting those the
+	// application missed
+	int frames = 1;
+	if( hasTime ) {
+		float dt = (float) (time - lastTime);
+		if( state == PROBING ) {
+			intervals.push_back(dt);
+		} else if( period > 0 ) {
+			frames = std::max(1, (int) (dt / period + 0.5f));
+		}
+	}
+	lastTime = time;
+	hasTime = true;
+	capture = -1;
+
+	if( state == PROBING ) {
+		updateProbe(brightness);
+	} else if( state == SCANNING ) {
+		updateScan(frames);
+	}
+}
+
+void CaptureScheduler::retry() {
+	if( capture >= 0 ) {
+		recapture();
+	}
+}
+
+void CaptureScheduler::updateProbe(float brightness) {
+	probeFrames++;
+	if( !flashing ) {
+		// dark until the previous image is surely gone, averaging the last
+		// frames as the baseline
+		if( probeFrames == DARK_FRAMES - BASE_FRAMES + 1 ) {
+			base = 0;
+		}
+		if( probeFrames > DARK_FRAMES - BASE_FRAMES ) {
+			base += brightness / BASE_FRAMES;
+		}
+		if( probeFrames == DARK_FRAMES ) {
+			flashing = true;
+			probeFrames = 0;
+			samples.clear();
+			display = DISPLAY_WHITE;
+		}
+		return;
+	}
+
+	// samples[i] is the frame i+1 frames after the flash was drawn; the
+	// flash is over once three frames agree
+	samples.push_back(brightness);
+	int n = samples.size();
+	bool stable = n >= 3 && brightness > base + minFlash &&
+		fabs(samples[n - 1] - samples[n - 2]) < 0.1f * (brightness - base) &&
+		fabs(samples[n - 1] - samples[n - 3]) < 0.1f * (brightness - base);
+	if( stable || n >= MAX_FLASH_FRAMES ) {
+		finishFlash();
+	}
+}
+
+void CaptureScheduler::finishFlash() {
+	float peak = *std::max_element(samples.begin(), samples.end());
+	if( peak - base < minFlash ) {
+		state = FAILED;
+		display = DISPLAY_BLACK;
+		latency = 0;
+		return;
+	}
+
+	// the first frame the flash reaches, and the first it fills. frames in
+	// between are exposed while the image changes, so each pattern is held
+	// long enough that the next one only reaches frames after the capture.
+	int rise = -1, full = -1;
+	for( int i = 0 ; i < (int) samples.size() ; i++ ) {
+		if( rise < 0 && samples[i] > base + 0.1f * (peak - base) ) {
+			rise = i + 1;
+		}
+		if( full < 0 && samples[i] >= base + 0.9f * (peak - base) ) {
+			full = i + 1;
+		}
+	}
+	latency = std::max(latency, full);
+	hold = std::max(hold, full - rise + 1);
+	flash = flash ? std::min(flash, peak - base) : peak - base;
+
+	flashing = false;
+	probeFrames = 0;
+	display = DISPLAY_BLACK;
+	if( ++probeCount < probes ) {
+		return;
+	}
+
+	std::vector<float> sorted = intervals;
+	std::sort(sorted.begin(), sorted.end());
+	period = sorted.empty() ? 0 : sorted[sorted.size() / 2];
+
+	if( scanAfterProbe ) {
+		start();
+	} else {
+		state = IDLE;
+	}
+}
+
+void CaptureScheduler::updateScan(int frames) {
+	if( frames > 1 ) {
+		// the images drawn while the frames were missed were not drawn on
+		// time; show the pattern to capture again
+		restarts++;
+		restart(next);
+		return;
+	}
+	frame++;
+
+	// frame 'latency' after a pattern is drawn shows it in full
+	int j = frame - latency;
+	if( j >= 0 && j % hold == 0 && first + j / hold == next ) {
+		capture = next++;
+	}
+
+	if( next >= numPatterns ) {
+		state = FINISHED;
+		display = DISPLAY_BLACK;
+		return;
+	}
+	int id = first + frame / hold;
+	display = id < numPatterns ? id : DISPLAY_BLACK;
+}
+
+void CaptureScheduler::check(const FrameView& frame) {
+	confidence = 1;
+	if( checkNext && minChange > 0 && flash > 0 ) {
+		confidence = change.Compare(frame, minChange * flash);
+		if( confidence < 1 ) {
+			// most likely the previous pattern again: the projector or the
+			// camera skipped a frame. capture the pattern once more, and take
+			// whatever comes then.
+			recapture();
+			return;
+		}
+	}
+	checkNext = true;
+	change.SetReference(frame);
+}
+
+void CaptureScheduler::recapture() {
+	next = capture;
+	capture = -1;
+	restarts++;
+	state = SCANNING;
+	restart(next);
+	// the frame may have become the reference already
+	checkNext = false;
+}
+
+void CaptureScheduler::restart(int pattern) {
+	first = pattern;
+	frame = 0;
+	display = pattern;
+}
+
+float CaptureScheduler::getBrightness(const FrameView& frame, int step) {
+	int w = frame.size(0);
+	int h = frame.size(1);
+	std::vector<float> row(w);
+	double sum = 0;
+	int count = 0;
+
+	for( int y = step / 2 ; y < h ; y += step ) {
+		frame.GetRow(y, &row[0]);
+		for( int x = step / 2 ; x < w ; x += step ) {
+			sum += row[x];
+			count++;
+		}
+	}
+
+	return count ? (float) (sum / count) : 0.f;
+}
+
+}
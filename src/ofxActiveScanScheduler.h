@@ -0,0 +1,143 @@
+/*
+    This file is part of ofxActiveScan.
+
+    ofxActiveScan is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ofxActiveScan is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ofxActiveScan.  If not, see <http://www.gnu.org/licenses/>.
+
+    Naoto Hieda <micuat@gmail.com> 2013
+ */
+
+#pragma once
+
+#include "ofMain.h"
+
+#include "ofxActiveScanTypes.h"
+
+namespace ofxActiveScan {
+
+// decides which pattern to display and which camera frames to decode.
+// the latency from drawing an image to a camera frame that shows it in full
+// is measured once by flashing the projector, in camera frames. the scan
+// then changes the pattern every 'hold' camera frames without waiting for
+// it to appear, and tags the frame arriving 'latency' frames after each
+// change with the pattern it shows, so a scan of n patterns takes about
+// latency + n * hold frames.
+//
+// call update() for every new camera frame, add the frame to the decoder
+// when getCapture() is a pattern, and draw getDisplay() until the next one.
+class CaptureScheduler {
+public:
+	enum { DISPLAY_BLACK = -1, DISPLAY_WHITE = -2 };
+	enum State { IDLE, PROBING, SCANNING, FINISHED, FAILED };
+
+	CaptureScheduler();
+
+	// a sequence of 'numPatterns' patterns, e.g. Encoder::GetNumImages().
+	// 'probes' flashes are measured and the slowest is kept.
+	void setup(int numPatterns, int probes = 3);
+
+	// scan from the first pattern, probing the latency first if it is
+	// not known yet
+	void start();
+	// measure the latency again, and scan afterwards if 'scan' is set
+	void probe(bool scan = false);
+	void stop();
+
+	// a new camera frame arrived at 'time' in milliseconds
+	void update(const FrameView& frame, unsigned long long time);
+	// same, with the mean intensity of the frame in [0,1], which the probe
+	// compares. captured frames are not checked.
+	void update(float brightness, unsigned long long time);
+
+	// pattern to draw until the next frame, or DISPLAY_BLACK / DISPLAY_WHITE
+	int getDisplay() const { return display; }
+	// pattern the last frame shows in full, -1 if it is not to be decoded.
+	// patterns are captured in order.
+	int getCapture() const { return capture; }
+	// the last captured frame could not be used; capture its pattern again
+	void retry();
+
+	// a captured frame must differ from the previous capture by at least
+	// 'minChange' times the mean brightness of the flash, or its pattern is
+	// captured once more; 0 accepts every frame. frames are only checked
+	// after a probe.
+	void setMinChange(float minChange) { this->minChange = minChange; }
+	// confidence in [0,1] that the last captured frame shows a new pattern
+	float getConfidence() const { return confidence; }
+
+	State getState() const { return state; }
+	bool isProbing() const { return state == PROBING; }
+	bool isScanning() const { return state == SCANNING; }
+	bool isFinished() const { return state == FINISHED; }
+	// the probe saw no flash: the camera does not see the projector
+	bool isFailed() const { return state == FAILED; }
+
+	bool isCalibrated() const { return latency > 0; }
+	// set the latency and hold in frames instead of probing
+	void setLatency(int latency, int hold = 1);
+	int getLatency() const { return latency; }
+	int getHold() const { return hold; }
+	// median interval of the camera frames in milliseconds
+	float getFramePeriod() const { return period; }
+	// frames and milliseconds an undisturbed scan takes
+	int getScanFrames() const;
+	float getScanTime() const { return getScanFrames() * period; }
+	// patterns shown again after dropped frames or retry()
+	int getRestarts() const { return restarts; }
+
+	// mean intensity in [0,1] of every 'step'-th pixel of every 'step'-th row
+	static float getBrightness(const FrameView& frame, int step = 8);
+
+private:
+	void updateProbe(float brightness);
+	void finishFlash();
+	void updateScan(int frames);
+	void restart(int pattern);
+	void recapture();
+	void check(const FrameView& frame);
+
+	enum { DARK_FRAMES = 15, BASE_FRAMES = 5, MAX_FLASH_FRAMES = 30 };
+
+	int numPatterns;
+	int probes;
+	State state;
+	bool scanAfterProbe;
+	int display, capture;
+
+	// timing
+	int latency, hold;
+	float period;
+	unsigned long long lastTime;
+	bool hasTime;
+	std::vector<float> intervals;
+
+	// probe
+	int probeCount;
+	bool flashing;
+	int probeFrames;
+	float base;
+	float flash; // mean brightness the flash adds
+	std::vector<float> samples;
+
+	// scan
+	int first; // pattern shown at frame 0
+	int frame; // frames since the pattern 'first' was drawn
+	int next; // pattern to capture next
+	int restarts;
+	FrameChange change; // against the previous capture
+	float minChange;
+	float confidence;
+	bool checkNext;
+};
+
+}
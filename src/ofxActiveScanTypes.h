@@ -20,19 +20,34 @@
 #pragma once
 
 #include "Field.h"
+#include "FrameView.h"
+#include "FrameChange.h"
+#include "FrameRing.h"
 #include "Options.h"
 
 class CEncode;
 class CDecode;
+class CAsyncDecode;
+class CPatternFamily;
+class CColorCrosstalk;
+class CPatternSequence;
 
 namespace ofxActiveScan {
 
 typedef CEncode Encoder;
 typedef CDecode Decoder;
+typedef CAsyncDecode AsyncDecoder;
+typedef CPatternFamily PatternFamily;
+typedef CColorCrosstalk ColorCrosstalk;
+typedef CPatternSequence PatternSequence;
 typedef options_t Options;
 typedef slib::Field<2,unsigned char> Map2u;
+typedef slib::Field<2,slib::CVector<3,unsigned char> > Map2u3;
 typedef slib::Field<2,int> Map2i;
 typedef slib::Field<2,float> Map2f;
+typedef slib::CFrameView FrameView;
+typedef slib::CFrameChange FrameChange;
+typedef slib::CFrameRing FrameRing;
 typedef slib::CDynamicMatrix<double> Matd;
 typedef slib::CVector<2,double> Vec2d;
 typedef slib::CVector<3,double> Vec3d;
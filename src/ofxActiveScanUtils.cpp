@@ -18,6 +18,7 @@
  */
 
 #include "ofxActiveScanUtils.h"
+#include "PatternSequence.h"
 
 namespace ofxActiveScan {
 
@@ -30,6 +31,26 @@ ofImage toOf(Map2u field) {
 	return img;
 }
 
+ofImage toOf(Map2u3 field) {
+	ofImage img;
+	int w = field.size(0);
+	int h = field.size(1);
+	
+	img.setFromPixels(&field.ptr()[0][0], w, h, OF_IMAGE_COLOR);
+	return img;
+}
+
+void loadTexture(const PatternSequence& sequence, int id, ofTexture& texture) {
+	int w = sequence.GetWidth();
+	int h = sequence.GetHeight();
+	int glFormat = sequence.GetChannels() == 3 ? GL_RGB : GL_LUMINANCE;
+	
+	if( !texture.isAllocated() || texture.getWidth() != w || texture.getHeight() != h ) {
+		texture.allocate(w, h, glFormat);
+	}
+	texture.loadData(sequence.GetImage(id), w, h, glFormat);
+}
+
 ofImage toOf(Map2f field) {
 	ofImage img;
 	int w = field.size(0);
@@ -110,7 +110,19 @@ inline cv::Point3d toCv(const Vec3d p) {
 }
 
 ofImage toOf(Map2u);
+ofImage toOf(Map2u3);
+
+// upload the 'id'-th frame of a precompiled sequence straight from the
+// mapped file, without generating or converting it
+void loadTexture(const PatternSequence&, int id, ofTexture&);
 ofImage toOf(Map2f);
 Map2f toAs(ofImage);
 
+// 8- or 16-bit pixels as a decoder frame, without copying.
+// the pixels must not be modified while the view is in use.
+template <typename T>
+inline FrameView toAs(const ofPixels_<T>& pixels) {
+	return FrameView(pixels.getPixels(), pixels.getWidth(), pixels.getHeight(), pixels.getNumChannels());
+}
+
 };